@@ -1,422 +1,4249 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <concepts>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <random>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <unordered_set>
+#include <variant>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 namespace ibf {
 
-/**
- * InvertibleBloomDictionarys are probabilistic structures
- * that can, in some cases, only answer probabilistically
- */
-enum ContainsResult { not_found, might_exist, exists };
+/**
+ * InvertibleBloomDictionarys are probabilistic structures
+ * that can, in some cases, only answer probabilistically
+ */
+enum ContainsResult { not_found, might_exist, exists };
+
+template <class Filter> class FilterGroup;
+template <class Filter> class TwoTierFilter;
+template <class Filter> class StashedFilter;
+template <class Dictionary> class FrozenDictionary;
+template <class Key, class Value, class HashFn, size_t K, class BucketCounter>
+class FlowEncoder;
+
+/**
+ * Tag requesting a sparse directory on construction, i.e., one that only
+ * stores non-empty buckets until storing them densely becomes cheaper
+ */
+struct sparse_t {
+  explicit sparse_t() = default;
+};
+inline constexpr sparse_t sparse{};
+
+/**
+ * Tag requesting listAll() to give up early on filters unlikely to decode,
+ * based on their DecodeEstimate and on the progress of peeling
+ */
+struct early_abort_t {
+  explicit early_abort_t() = default;
+};
+inline constexpr early_abort_t early_abort{};
+
+/**
+ * Estimate of a directory's contents based on the fractions of empty and pure
+ * buckets, e.g., to size a larger filter before attempting to decode
+ */
+struct DecodeEstimate {
+  // estimated amount of keys, infinite if no bucket is empty or pure, i.e.,
+  // the directory is saturated
+  double keys;
+  // estimated keys per bucket, infinite if saturated
+  double load;
+  // standard error of load
+  double error;
+  // false if load most likely exceeds the peeling threshold of the filter's
+  // degree distribution, in which case decoding will fail
+  bool peelable;
+};
+
+namespace detail {
+/**
+ * Deterministically derives K distinct hash seeds from seed
+ */
+template <class Seed, size_t K>
+std::array<Seed, K> generate_seeds(unsigned int seed) {
+  std::array<Seed, K> seeds;
+
+  std::default_random_engine rng(seed);
+  std::uniform_int_distribution<Seed> dist(std::numeric_limits<Seed>::min(),
+                                           std::numeric_limits<Seed>::max());
+
+  for (size_t i = 0; i < K; i++) {
+    // generate until we find a new random seed
+    Seed rand_seed = 0;
+    bool already_exists = false;
+    do {
+      rand_seed = dist(rng);
+      already_exists = false;
+      for (size_t j = 0; j < i; j++)
+        already_exists |= seeds[j] == rand_seed;
+    } while (already_exists);
+
+    seeds[i] = rand_seed;
+  }
+
+  return seeds;
+}
+
+// directories at least this large (in bytes) are cleared using madvise()
+constexpr size_t madvise_threshold = size_t(1) << 26;
+
+/**
+ * Resets every bucket to its empty (all zero) state. Large directories on
+ * linux instead hand their pages back to the kernel using
+ * madvise(MADV_DONTNEED), which makes them read as zero on next access without
+ * writing (and evicting caches for) the whole directory
+ */
+template <class Bucket> void clear_buckets(Bucket *buckets, size_t size) {
+  static_assert(std::is_trivially_copyable_v<Bucket>);
+
+#ifdef __linux__
+  const auto bytes = size * sizeof(Bucket);
+  if (bytes >= madvise_threshold) {
+    static const auto page_size = size_t(sysconf(_SC_PAGESIZE));
+
+    auto *begin = reinterpret_cast<std::uint8_t *>(buckets);
+    auto *end = begin + bytes;
+    auto *page_begin = reinterpret_cast<std::uint8_t *>(
+        (reinterpret_cast<std::uintptr_t>(begin) + page_size - 1) &
+        ~(page_size - 1));
+    auto *page_end = reinterpret_cast<std::uint8_t *>(
+        reinterpret_cast<std::uintptr_t>(end) & ~(page_size - 1));
+
+    if (madvise(page_begin, page_end - page_begin, MADV_DONTNEED) == 0) {
+      std::memset(begin, 0, page_begin - begin);
+      std::memset(page_end, 0, end - page_end);
+      return;
+    }
+  }
+#endif
+
+  std::fill(buckets, buckets + size, Bucket{});
+}
+
+/**
+ * Murmur3's 64-bit finalizer, a cheap bijective mixing function in which every
+ * input bit affects every output bit
+ */
+constexpr std::uint64_t mix(std::uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdLLU;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53LLU;
+  x ^= x >> 33;
+  return x;
+}
+
+// largest directory size whose indices reduce() computes in 32-bit arithmetic
+constexpr size_t max_narrow_size = std::numeric_limits<std::uint32_t>::max();
+
+/**
+ * Maps hash to [0, size) by multiplying with size and keeping the high half
+ * of the product (fast range reduction) instead of dividing. Sizes up to
+ * max_narrow_size only need a 32x32 -> 64-bit multiply of the hash's high
+ * half, which unlike a 64-bit multiply-high also vectorizes. Hence the hash's
+ * high bits decide the index
+ */
+[[gnu::always_inline]] inline size_t reduce(std::uint64_t hash, size_t size) {
+  if (size <= max_narrow_size) [[likely]]
+    return static_cast<std::uint32_t>(
+        ((hash >> 32) * static_cast<std::uint32_t>(size)) >> 32);
+  return static_cast<size_t>(
+      (static_cast<unsigned __int128>(hash) * size) >> 64);
+}
+
+/**
+ * a ^= b for any trivially copyable T. Types without operator^=, e.g.,
+ * structs, floating point types or std::arrays, are xor-ed byte-wise. Their
+ * size is known at compile time, hence the word-wise loop below fully unrolls
+ * and vectorizes
+ */
+template <class T>
+[[gnu::always_inline]] inline void xor_into(T &a, const T &b) {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  if constexpr (requires(T x, const T y) { x ^= y; }) {
+    a ^= b;
+  } else {
+    auto *dst = reinterpret_cast<unsigned char *>(&a);
+    const auto *src = reinterpret_cast<const unsigned char *>(&b);
+
+    constexpr auto word = sizeof(std::uint64_t);
+    size_t i = 0;
+    for (; i + word <= sizeof(T); i += word) {
+      std::uint64_t x, y;
+      std::memcpy(&x, dst + i, sizeof(x));
+      std::memcpy(&y, src + i, sizeof(y));
+      x ^= y;
+      std::memcpy(dst + i, &x, sizeof(x));
+    }
+    for (; i < sizeof(T); i++)
+      dst[i] ^= src[i];
+  }
+}
+
+/**
+ * Calls fn(std::integral_constant<size_t, I>{}) for every I in [0, N), i.e.,
+ * fully unrolls loops over the K probes of a key at compile time
+ */
+template <size_t N, class Fn>
+[[gnu::always_inline]] constexpr void unroll(Fn &&fn) {
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    (fn(std::integral_constant<size_t, I>{}), ...);
+  }(std::make_index_sequence<N>{});
+}
+
+/**
+ * Bitmask of probes whose index repeats the index of an earlier probe. Such
+ * buckets must only be updated once per key
+ */
+template <size_t K>
+std::uint32_t duplicate_probes(const std::array<size_t, K> &indices) {
+  static_assert(K <= 32);
+
+  std::uint32_t duplicates = 0;
+  unroll<K>([&](auto i) {
+    unroll<decltype(i)::value>([&](auto j) {
+      duplicates |= std::uint32_t(indices[i] == indices[j]) << i;
+    });
+  });
+  return duplicates;
+}
+
+/**
+ * Per probe classification of the K buckets a key hashes to, bit i
+ * corresponding to the i-th probe
+ */
+struct ProbeMasks {
+  // bucket holds exactly one key
+  std::uint32_t pure = 0;
+  // bucket's cumulative key equals the probed key
+  std::uint32_t match = 0;
+  // bucket holds more than one key
+  std::uint32_t ambiguous = 0;
+
+  /**
+   * Index of the probe that decides lookups, i.e., the first pure one. Only
+   * meaningful if pure != 0
+   */
+  size_t deciding_probe() const { return std::countr_zero(pure); }
+
+  /**
+   * The first pure bucket decides whether key exists. Without pure buckets,
+   * key might exist if any of its buckets is ambiguous
+   */
+  ContainsResult contains() const {
+    if (pure != 0)
+      return (match >> deciding_probe()) & 1 ? ContainsResult::exists
+                                             : ContainsResult::not_found;
+    return ambiguous != 0 ? ContainsResult::might_exist
+                          : ContainsResult::not_found;
+  }
+};
+
+/**
+ * Loads all K buckets before looking at any of them, so that their cache
+ * misses overlap, and combines them into ProbeMasks without branching. Worth
+ * it whenever all K buckets are needed anyway, e.g., before updating them
+ */
+template <size_t K, class Key, class Directory>
+[[gnu::always_inline]] inline ProbeMasks
+probe(const Directory &buckets, const std::array<size_t, K> &indices,
+      const Key &key) {
+  static_assert(K <= 32);
+
+  ProbeMasks masks;
+  unroll<K>([&](auto i) {
+    const auto &bucket = buckets[indices[i]];
+    masks.pure |= std::uint32_t(bucket.count == 1) << i;
+    masks.match |= std::uint32_t(bucket.cumulative_key == key) << i;
+    masks.ambiguous |= std::uint32_t(bucket.count > 1) << i;
+  });
+  return masks;
+}
+
+/**
+ * Open addressing (linear probing) table of the buckets a sparse directory
+ * stores, keyed by bucket index. Buckets once written stay stored, even if
+ * they become empty again
+ */
+template <class Bucket> class SparseBuckets {
+  static constexpr size_t unused = std::numeric_limits<size_t>::max();
+
+  struct Slot {
+    size_t index = unused;
+    Bucket bucket{};
+  };
+
+  std::vector<Slot> slots;
+  size_t used = 0;
+
+  size_t slot(size_t index) const { return mix(index) & (slots.size() - 1); }
+  size_t next(size_t slot) const { return (slot + 1) & (slots.size() - 1); }
+
+public:
+  static constexpr size_t slot_bytes = sizeof(Slot);
+
+  explicit SparseBuckets(size_t capacity = 16) : slots(capacity) {
+    assert(std::has_single_bit(capacity));
+  }
+
+  size_t size() const { return used; }
+  size_t capacity() const { return slots.size(); }
+
+  /**
+   * Whether storing another bucket requires growing first, which keeps the
+   * load factor at or below 1/2
+   */
+  bool full() const { return 2 * (used + 1) > slots.size(); }
+
+  const Bucket *find(size_t index) const {
+    for (auto s = slot(index);; s = next(s)) {
+      if (slots[s].index == index)
+        return &slots[s].bucket;
+      if (slots[s].index == unused)
+        return nullptr;
+    }
+  }
+
+  /**
+   * Returns the stored bucket for index, storing an empty one if there is
+   * none. Must not be called on a full() table for new indices
+   */
+  Bucket &insert(size_t index) {
+    for (auto s = slot(index);; s = next(s)) {
+      if (slots[s].index == index)
+        return slots[s].bucket;
+      if (slots[s].index == unused) {
+        assert(!full());
+        used++;
+        slots[s].index = index;
+        return slots[s].bucket;
+      }
+    }
+  }
+
+  void grow() {
+    SparseBuckets grown(2 * slots.size());
+    for_each([&](size_t index, const Bucket &bucket) {
+      grown.insert(index) = bucket;
+    });
+    *this = std::move(grown);
+  }
+
+  /**
+   * Calls fn(index, bucket) for every stored bucket, in no particular order
+   */
+  template <class Fn> void for_each(Fn &&fn) const {
+    for (const auto &slot : slots)
+      if (slot.index != unused)
+        fn(slot.index, slot.bucket);
+  }
+
+  void clear() {
+    std::fill(slots.begin(), slots.end(), Slot{});
+    used = 0;
+  }
+};
+
+/**
+ * Bucket directory split into fixed size, reference counted pages. Copying a
+ * directory only copies its page table, i.e., copies share all pages until
+ * they are written, at which point the written page is copied (copy on
+ * write). Snapshots therefore cost O(#pages) upfront plus O(page) for each
+ * page touched afterwards instead of O(directory).
+ *
+ * Freshly constructed directories are backed by a single contiguous
+ * allocation, which clear() can hand back to the kernel as a whole. Until a
+ * write has to copy a page, they access buckets in that allocation directly,
+ * and writes skip the page table while no copy exists, hence directories that
+ * are never snapshotted cost as much as a flat array.
+ *
+ * Sharing is tracked by reference counts, which are only exact while no other
+ * thread changes them: copies may be taken and released concurrently with
+ * reads, but not with writes to any directory sharing their pages.
+ *
+ * Sparse directories instead start out storing only written buckets in a
+ * SparseBuckets table, shared between copies as a whole. Once growing that
+ * table would take more memory than storing all buckets, they switch to the
+ * dense paged representation for good
+ */
+template <class Bucket> class PagedDirectory {
+  using Page = std::shared_ptr<Bucket[]>;
+
+  // pages hold a power of two amount of buckets worth roughly 64 KiB
+  static constexpr size_t page_buckets =
+      std::bit_floor(std::max(size_t(1), (size_t(1) << 16) / sizeof(Bucket)));
+  static constexpr size_t page_shift = std::countr_zero(page_buckets);
+  static constexpr size_t page_mask = page_buckets - 1;
+
+  std::vector<Page> pages;
+  size_t bucket_count;
+  // only set while sparse, in which case pages is empty
+  std::shared_ptr<SparseBuckets<Bucket>> sparse;
+  // start of the contiguous allocation while every page still lives in it,
+  // never set on copies
+  Bucket *flat = nullptr;
+  // shared by the directory owning flat and all its copies, hence held once
+  // while no copy shares any page
+  std::shared_ptr<const bool> lineage;
+
+  size_t page_size(size_t page) const {
+    return std::min(page_buckets, bucket_count - page * page_buckets);
+  }
+
+  void unshare(size_t page) {
+    const auto size = page_size(page);
+    Page copy(new Bucket[size]);
+    std::copy(pages[page].get(), pages[page].get() + size, copy.get());
+    pages[page] = std::move(copy);
+  }
+
+  void allocate() {
+    pages.resize((bucket_count + page_buckets - 1) / page_buckets);
+    if (pages.empty())
+      return;
+
+    // single contiguous allocation, shared by all pages of this directory
+    const auto slab = std::make_shared<Bucket[]>(bucket_count);
+    flat = slab.get();
+    lineage = std::make_shared<const bool>();
+    if (pages.size() == 1) {
+      pages[0] = slab;
+      return;
+    }
+    for (size_t page = 0; page < pages.size(); page++)
+      pages[page] = Page(slab.get() + page * page_buckets, [slab](Bucket *) {});
+  }
+
+  // kept out of line, which keeps dense lookups as fast as without sparse mode
+  [[gnu::noinline]] const Bucket &find_sparse(size_t i) const {
+    static const Bucket empty{};
+    const auto *bucket = sparse->find(i);
+    return bucket != nullptr ? *bucket : empty;
+  }
+
+  void densify() {
+    const auto stored = std::move(sparse);
+    allocate();
+    stored->for_each([&](size_t i, const Bucket &bucket) {
+      pages[i >> page_shift][i & page_mask] = bucket;
+    });
+  }
+
+public:
+  explicit PagedDirectory(size_t size) : bucket_count(size) { allocate(); }
+
+  PagedDirectory(size_t size, sparse_t)
+      : bucket_count(size),
+        sparse(std::make_shared<SparseBuckets<Bucket>>()) {}
+
+  PagedDirectory(const PagedDirectory &other)
+      : pages(other.pages), bucket_count(other.bucket_count),
+        sparse(other.sparse), lineage(other.lineage) {}
+
+  PagedDirectory(PagedDirectory &&other) noexcept
+      : pages(std::move(other.pages)), bucket_count(other.bucket_count),
+        sparse(std::move(other.sparse)),
+        flat(std::exchange(other.flat, nullptr)),
+        lineage(std::move(other.lineage)) {}
+
+  PagedDirectory &operator=(const PagedDirectory &other) {
+    return *this = PagedDirectory(other);
+  }
+
+  PagedDirectory &operator=(PagedDirectory &&other) noexcept {
+    pages = std::move(other.pages);
+    bucket_count = other.bucket_count;
+    sparse = std::move(other.sparse);
+    flat = std::exchange(other.flat, nullptr);
+    lineage = std::move(other.lineage);
+    return *this;
+  }
+
+  size_t size() const { return bucket_count; }
+
+  bool is_sparse() const { return sparse != nullptr; }
+
+  /**
+   * Copies all buckets into the contiguous range starting at out. Dense
+   * directories only
+   */
+  void copy_to(Bucket *out) const {
+    assert(!sparse);
+    for (size_t page = 0; page < pages.size(); page++)
+      out = std::copy(pages[page].get(), pages[page].get() + page_size(page),
+                      out);
+  }
+
+  /**
+   * Calls fn(i, bucket) for every bucket a sparse directory stores, in no
+   * particular order. Sparse directories only
+   */
+  template <class Fn> void for_each_stored(Fn &&fn) const {
+    assert(sparse);
+    sparse->for_each(fn);
+  }
+
+  /**
+   * Read access to the i-th bucket. Never copies
+   */
+  const Bucket &operator[](size_t i) const {
+    if (flat) [[likely]]
+      return flat[i];
+    if (sparse) [[unlikely]]
+      return find_sparse(i);
+    return pages[i >> page_shift][i & page_mask];
+  }
+
+  /**
+   * Write access to the i-th bucket. Copies the bucket's page first if it is
+   * shared with another directory
+   */
+  Bucket &mutate(size_t i) {
+    if (flat && lineage.use_count() == 1) [[likely]]
+      return flat[i];
+
+    if (sparse) [[unlikely]] {
+      if (sparse.use_count() != 1)
+        sparse = std::make_shared<SparseBuckets<Bucket>>(*sparse);
+
+      if (sparse->find(i) == nullptr && sparse->full()) {
+        const auto grown_bytes =
+            2 * sparse->capacity() * SparseBuckets<Bucket>::slot_bytes;
+        if (grown_bytes >= bucket_count * sizeof(Bucket))
+          densify();
+        else
+          sparse->grow();
+      }
+      if (sparse)
+        return sparse->insert(i);
+    }
+
+    const auto page = i >> page_shift;
+    if (pages[page].use_count() != 1) {
+      unshare(page);
+      flat = nullptr;
+    }
+    return pages[page][i & page_mask];
+  }
+
+  /**
+   * Empties every bucket. Pages shared with other directories are replaced
+   * instead of written
+   */
+  void clear() {
+    if (sparse) {
+      if (sparse.use_count() == 1)
+        sparse->clear();
+      else
+        sparse = std::make_shared<SparseBuckets<Bucket>>();
+      return;
+    }
+
+    bool contiguous = true;
+    for (size_t page = 0; page < pages.size(); page++)
+      contiguous &= pages[page].use_count() == 1 &&
+                    pages[page].get() == pages[0].get() + page * page_buckets;
+
+    if (contiguous) {
+      if (!pages.empty()) {
+        clear_buckets(pages[0].get(), bucket_count);
+        // copies may still share lineage, but no longer any page
+        if (!flat) {
+          flat = pages[0].get();
+          lineage = std::make_shared<const bool>();
+        }
+      }
+      return;
+    }
+
+    for (size_t page = 0; page < pages.size(); page++) {
+      if (pages[page].use_count() == 1)
+        clear_buckets(pages[page].get(), page_size(page));
+      else
+        pages[page] = std::make_shared<Bucket[]>(page_size(page));
+    }
+  }
+};
+
+/**
+ * Amounts of empty and pure, i.e., single key buckets of directory
+ */
+template <class Bucket>
+std::pair<size_t, size_t> occupancy(const PagedDirectory<Bucket> &directory) {
+  size_t empty = 0, pure = 0;
+  if (directory.is_sparse()) {
+    empty = directory.size();
+    directory.for_each_stored([&](size_t, const Bucket &bucket) {
+      empty -= bucket.count != 0;
+      pure += bucket.count == 1;
+    });
+    return {empty, pure};
+  }
+
+  for (size_t i = 0; i < directory.size(); i++) {
+    empty += directory[i].count == 0;
+    pure += directory[i].count == 1;
+  }
+  return {empty, pure};
+}
+
+/**
+ * Load below which random K-uniform hypergraphs peel completely with high
+ * probability as their size grows
+ */
+constexpr double peeling_threshold(size_t k) {
+  constexpr std::array<double, 11> thresholds{
+      0, 0, 0.5, 0.818, 0.772, 0.702, 0.637, 0.582, 0.535, 0.495, 0.461};
+  return k < thresholds.size() ? thresholds[k]
+                               : thresholds.back() * 10 / double(k);
+}
+
+/**
+ * Average amount of buckets per key under DegreePolicy
+ */
+template <size_t K, class DegreePolicy> constexpr double average_degree() {
+  constexpr auto fractions = DegreePolicy::template degrees<K>();
+  double average = 0;
+  for (size_t d = 0; d <= K; d++)
+    average += double(d) * fractions[d];
+  return average;
+}
+
+/**
+ * Fraction of keys peeling is expected to leave after round rounds at load,
+ * following the density evolution of peeling random hypergraphs whose edge
+ * sizes are distributed like DegreePolicy's degrees. Decoders peel round by
+ * round like this model, each round peeling the buckets the previous one left
+ * pure
+ */
+template <size_t K, class DegreePolicy>
+double expected_remaining(double load, size_t rounds) {
+  constexpr auto fractions = DegreePolicy::template degrees<K>();
+  constexpr auto average = average_degree<K, DegreePolicy>();
+  const double lambda = load * average;
+  // probability that a key still blocks a given bucket of one of its peers,
+  // i.e., of a key weighted by its degree
+  double blocking = 1;
+  double remaining = 1;
+  for (size_t round = 0; round < rounds; round++) {
+    const double stuck = 1 - std::exp(-lambda * blocking);
+    blocking = remaining = 0;
+    for (size_t d = 1; d <= K; d++) {
+      if (fractions[d] == 0)
+        continue;
+      blocking += double(d) * fractions[d] / average * std::pow(stuck, d - 1);
+      remaining += fractions[d] * std::pow(stuck, d);
+    }
+  }
+  return remaining;
+}
+
+/**
+ * Peeling threshold of keys whose degrees are distributed like DegreePolicy's.
+ * Irregular ones are bisected once per policy as the highest load at which
+ * density evolution still converges
+ */
+template <size_t K, class DegreePolicy> double peeling_threshold() {
+  if constexpr (DegreePolicy::template degrees<K>()[K] == 1) {
+    return peeling_threshold(K);
+  } else {
+    static const double threshold = [] {
+      double low = 0, high = 1;
+      for (size_t i = 0; i < 30; i++) {
+        const double mid = (low + high) / 2;
+        (expected_remaining<K, DegreePolicy>(mid, 1000) < 1e-6 ? low : high) =
+            mid;
+      }
+      return low;
+    }();
+    return threshold;
+  }
+}
+
+/**
+ * Estimates the keys in a directory of size buckets, whose keys probe as many
+ * buckets as DegreePolicy decides. Bucket occupancy is Poisson distributed
+ * with mean average degree * keys / size, which is estimated by maximum
+ * likelihood from the amounts of empty, pure and other buckets. Only predicts
+ * failure if the load exceeds the peeling threshold by more than two standard
+ * errors, as estimates of small directories are noisy
+ */
+template <size_t K, class DegreePolicy>
+DecodeEstimate estimate_decode(size_t size, size_t empty, size_t pure) {
+  // all empty, including directories without buckets, i.e., nothing to peel
+  if (empty == size)
+    return {0, 0, 0, true};
+
+  const double m = double(size), e = double(empty), p = double(pure),
+               r = m - e - p;
+  constexpr auto average = average_degree<K, DegreePolicy>();
+
+  // the log likelihood's derivative decreases in lambda, bisect its root
+  // geometrically, as huge sparse directories hold tiny lambdas
+  const auto slope = [&](double lambda) {
+    const double crowded = -std::expm1(-lambda) - lambda * std::exp(-lambda);
+    return -e + p * (1 / lambda - 1) +
+           (r > 0 ? r * lambda * std::exp(-lambda) / crowded : 0);
+  };
+  double low = 0.5 / m, high = 64;
+
+  // without empty and pure buckets the likelihood grows without bound, i.e.,
+  // the directory is saturated and any load fits
+  if (slope(high) >= 0) {
+    constexpr auto saturated = std::numeric_limits<double>::infinity();
+    return {saturated, saturated, 0, false};
+  }
+
+  for (size_t i = 0; i < 64; i++) {
+    const double mid = std::sqrt(low * high);
+    (slope(mid) > 0 ? low : high) = mid;
+  }
+  const double lambda = std::sqrt(low * high);
+
+  // Fisher information of the three bucket categories
+  const double p0 = std::exp(-lambda), p1 = lambda * p0, p2 = 1 - p0 - p1;
+  const double information =
+      m * (p0 + p0 * (1 - lambda) * (1 - lambda) / lambda +
+           (p2 > 0 ? p1 * p1 / p2 : 0));
+  const double load = lambda / average;
+  const double error = 1 / std::sqrt(information) / average;
+
+  return {load * m, load, error,
+          load - 2 * error < peeling_threshold<K, DegreePolicy>()};
+}
+
+/**
+ * Scratch copy of a directory to decode in, allocated from a memory_resource.
+ * Copies dense directories as is, and sparse ones as the run of their stored
+ * buckets sorted by index, which is then binary searched instead of indexed
+ */
+template <class Bucket> class Scratch {
+  std::pmr::vector<Bucket> buckets;
+  // bucket index of every scratch position, only used if sparse
+  std::pmr::vector<size_t> indices;
+  bool sparse;
+
+public:
+  Scratch(const PagedDirectory<Bucket> &directory,
+          std::pmr::memory_resource *resource)
+      : buckets(resource), indices(resource), sparse(directory.is_sparse()) {
+    if (!sparse) {
+      buckets.resize(directory.size());
+      directory.copy_to(buckets.data());
+      return;
+    }
+
+    std::pmr::vector<std::pair<size_t, Bucket>> run(resource);
+    directory.for_each_stored([&](size_t i, const Bucket &bucket) {
+      run.emplace_back(i, bucket);
+    });
+    std::sort(run.begin(), run.end(), [](const auto &a, const auto &b) {
+      return a.first < b.first;
+    });
+
+    buckets.reserve(run.size());
+    indices.reserve(run.size());
+    for (const auto &[i, bucket] : run) {
+      indices.push_back(i);
+      buckets.push_back(bucket);
+    }
+  }
+
+  /**
+   * Amount of scratch positions, i.e., of buckets to scan
+   */
+  size_t size() const { return buckets.size(); }
+
+  size_t index(size_t position) const {
+    return sparse ? indices[position] : position;
+  }
+
+  Bucket &operator[](size_t position) { return buckets[position]; }
+
+  /**
+   * Resource this scratch allocates from, e.g., for further decoding state
+   */
+  std::pmr::memory_resource *resource() const {
+    return buckets.get_allocator().resource();
+  }
+
+  /**
+   * Prefetches the bucket with directory index i. Sparse scratches locate
+   * buckets by binary search, hence only dense ones prefetch
+   */
+  void prefetch(size_t i) const {
+    if (!sparse)
+      __builtin_prefetch(&buckets[i]);
+  }
+
+  /**
+   * Bucket with directory index i, or nullptr if a sparse scratch does not
+   * hold it, i.e., if it is empty
+   */
+  Bucket *find(size_t i) {
+    if (!sparse)
+      return &buckets[i];
+
+    const auto it = std::lower_bound(indices.begin(), indices.end(), i);
+    return it != indices.end() && *it == i ? &buckets[it - indices.begin()]
+                                           : nullptr;
+  }
+
+  /**
+   * Bucket with directory index i. Sparse scratches only hold stored buckets,
+   * i.e., i must be one
+   */
+  Bucket &at(size_t i) {
+    if (!sparse)
+      return buckets[i];
+
+    const auto it = std::lower_bound(indices.begin(), indices.end(), i);
+    assert(it != indices.end() && *it == i);
+    return buckets[it - indices.begin()];
+  }
+};
+
+/**
+ * Incremental Gaussian elimination over GF(2) on bit-parallel rows, i.e., 64
+ * coefficients per word. Keeps one pivot row per column, whose lowest set
+ * coefficient is that column
+ */
+class GF2Elimination {
+  size_t unknowns;
+  size_t words;
+  // pivot row of every column followed by its right hand side
+  std::vector<std::uint64_t> pivots;
+  std::vector<std::uint8_t> has_pivot;
+  size_t pivot_count = 0;
+
+  std::uint64_t *pivot(size_t column) {
+    return &pivots[column * (words + 1)];
+  }
+  const std::uint64_t *pivot(size_t column) const {
+    return &pivots[column * (words + 1)];
+  }
+
+public:
+  explicit GF2Elimination(size_t unknowns)
+      : unknowns(unknowns), words((unknowns + 63) / 64),
+        pivots(unknowns * (words + 1), 0), has_pivot(unknowns, 0) {}
+
+  /**
+   * Amount of words per row
+   */
+  size_t row_words() const { return words; }
+
+  size_t rank() const { return pivot_count; }
+
+  /**
+   * Adds the equation row = rhs, reducing row in place. Returns false if it
+   * contradicts the equations added before
+   */
+  bool add(std::uint64_t *row, bool rhs) {
+    for (size_t w = 0; w < words; w++) {
+      while (row[w] != 0) {
+        const auto column = w * 64 + std::countr_zero(row[w]);
+        auto *p = pivot(column);
+        if (!has_pivot[column]) {
+          std::copy(row, row + words, p);
+          p[words] = rhs;
+          has_pivot[column] = 1;
+          pivot_count++;
+          return true;
+        }
+
+        for (size_t v = w; v < words; v++)
+          row[v] ^= p[v];
+        rhs ^= p[words] & 1;
+      }
+    }
+    return !rhs;
+  }
+
+  /**
+   * The unique solution by back substitution. Requires rank() == unknowns
+   */
+  std::vector<std::uint8_t> solve() const {
+    assert(pivot_count == unknowns);
+
+    std::vector<std::uint8_t> x(unknowns, 0);
+    for (size_t column = unknowns; column-- > 0;) {
+      const auto *p = pivot(column);
+      auto bit = static_cast<std::uint8_t>(p[words] & 1);
+      for (size_t w = column / 64; w < words; w++) {
+        auto word = p[w];
+        if (w == column / 64)
+          word &= ~std::uint64_t(0) << (column % 64) << 1;
+        for (; word != 0; word &= word - 1)
+          bit ^= x[w * 64 + std::countr_zero(word)];
+      }
+      x[column] = bit;
+    }
+    return x;
+  }
+};
+} // namespace detail
+
+/**
+ * Hash functions taking a seed alongside the key, i.e., families of hash
+ * functions indexed by seed. Filters evaluate these once per probe, using the
+ * probe's seed, instead of deriving all probes from a single unseeded hash by
+ * xor-ing it with the seeds, which correlates the probes for power of two
+ * directory sizes and hash functions with weak low bits
+ */
+template <class HashFn, class Key>
+concept SeededHashFn = requires(const HashFn &hasher, const Key &key,
+                                std::uint64_t seed) {
+  { hasher(key, seed) } -> std::convertible_to<std::uint64_t>;
+};
+
+/**
+ * Seeded family built from an unseeded HashFn by folding the seed into a final
+ * mixing round. Filters derive probes from unseeded hash functions this way
+ */
+template <class HashFn> struct SeedMixed {
+  HashFn hasher{};
+
+  template <class Key>
+  constexpr std::uint64_t operator()(const Key &key, std::uint64_t seed) const {
+    return detail::mix(static_cast<std::uint64_t>(hasher(key)) ^ seed);
+  }
+};
+
+/**
+ * Seeded family built from an unseeded HashFn by multiplying with a per-seed
+ * odd multiplier, folding the high half of the 128-bit product into the low
+ * one. Cheaper than SeedMixed, at the cost of weaker mixing
+ */
+template <class HashFn> struct SeedMultiplied {
+  HashFn hasher{};
+
+  template <class Key>
+  constexpr std::uint64_t operator()(const Key &key, std::uint64_t seed) const {
+    const auto hash = static_cast<std::uint64_t>(hasher(key));
+    const auto product = static_cast<unsigned __int128>(hash) * (seed | 1);
+    return static_cast<std::uint64_t>(product) ^
+           static_cast<std::uint64_t>(product >> 64);
+  }
+};
+
+/**
+ * Hash functions with state derived from a seed. Filters reseed these with
+ * their own seed and their n probe seeds on construction and reset(), so that
+ * filters with equal seeds hash equally
+ */
+template <class HashFn>
+concept ReseedableHashFn = requires(HashFn &hasher, unsigned int seed,
+                                    const std::uint64_t *probe_seeds,
+                                    size_t n) {
+  hasher.reseed(seed, probe_seeds, n);
+};
+
+/**
+ * Seeded hash functions that also hash n keys under the same seed at once,
+ * writing the results to hashes. Used by batched filter operations
+ */
+template <class HashFn, class Key>
+concept BatchedHashFn =
+    SeededHashFn<HashFn, Key> &&
+    requires(const HashFn &hasher, const Key *keys, size_t n,
+             std::uint64_t seed, std::uint64_t *hashes) {
+      hasher.hash_batch(keys, n, seed, hashes);
+    };
+
+namespace detail {
+template <class HashFn, size_t N>
+void reseed(HashFn &hasher, unsigned int seed,
+            const std::array<std::uint64_t, N> &probe_seeds) {
+  if constexpr (ReseedableHashFn<HashFn>)
+    hasher.reseed(seed, probe_seeds.data(), N);
+}
+} // namespace detail
+
+/**
+ * Simple tabulation hashing: xors together one random table entry per key
+ * byte. Peels like a truly random hash function even on structured keys.
+ * Every probe seed gets its own independently generated tables (16 KiB for
+ * 64-bit keys), hence a filter's K probes are independent as well, at K times
+ * the tables, e.g., 48 KiB for K = 3, which stay L1 or L2 resident.
+ *
+ * Tables are generated from the filter's seed. Seeds without tables of their
+ * own, e.g., when hashing standalone, hash the key xor-ed with the seed under
+ * the first tables, which relates such probes: h_s(x) == h_t(x ^ s ^ t).
+ * Copies own their tables, hence reseeding never allocates unless the amount
+ * of probe seeds changes
+ */
+template <class Key> class SimpleTabulation {
+  static_assert(std::is_unsigned_v<Key>);
+
+  using Tables = std::array<std::array<std::uint64_t, 256>, sizeof(Key)>;
+  // probe seeds and their tables, tables[i] belonging to seeds[i]. Holds at
+  // least one set of tables
+  std::vector<std::uint64_t> seeds;
+  std::vector<Tables> tables;
+
+  /**
+   * Tables of seed and the value keys are xor-ed with before looking them up
+   */
+  std::pair<const Tables *, Key> select(std::uint64_t seed) const {
+    for (size_t i = 0; i < seeds.size(); i++)
+      if (seeds[i] == seed)
+        return {&tables[i], Key(0)};
+    return {&tables[0], static_cast<Key>(seed)};
+  }
+
+public:
+  explicit SimpleTabulation(unsigned int seed = 0) {
+    reseed(seed, nullptr, 0);
+  }
+
+  /**
+   * Regenerates one set of tables per probe seed from seed, in place
+   */
+  void reseed(unsigned int seed, const std::uint64_t *probe_seeds, size_t n) {
+    seeds.assign(probe_seeds, probe_seeds + n);
+    tables.resize(std::max(n, size_t(1)));
+
+    std::mt19937_64 rng(seed);
+    for (auto &set : tables)
+      for (auto &table : set)
+        for (auto &entry : table)
+          entry = rng();
+  }
+
+  std::uint64_t operator()(const Key &key, std::uint64_t seed) const {
+    const auto [set, offset] = select(seed);
+    const auto x = key ^ offset;
+
+    std::uint64_t hash = 0;
+    for (size_t i = 0; i < sizeof(Key); i++)
+      hash ^= (*set)[i][(x >> (8 * i)) & 0xFF];
+    return hash;
+  }
+
+  /**
+   * Hashes n keys under seed. Uses AVX2 gathers, i.e., four table lookups per
+   * instruction, for 64-bit keys if available
+   */
+  void hash_batch(const Key *keys, size_t n, std::uint64_t seed,
+                  std::uint64_t *hashes) const {
+    size_t i = 0;
+#ifdef __AVX2__
+    if constexpr (sizeof(Key) == sizeof(std::uint64_t)) {
+      const auto [set, offset] = select(seed);
+      const auto offsets = _mm256_set1_epi64x(static_cast<long long>(offset));
+      const auto byte = _mm256_set1_epi64x(0xFF);
+      for (; i + 4 <= n; i += 4) {
+        const auto x = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)),
+            offsets);
+
+        auto hash = _mm256_setzero_si256();
+        detail::unroll<sizeof(Key)>([&](auto j) {
+          const auto index =
+              _mm256_and_si256(_mm256_srli_epi64(x, 8 * j), byte);
+          hash = _mm256_xor_si256(
+              hash, _mm256_i64gather_epi64(
+                        reinterpret_cast<const long long *>((*set)[j].data()),
+                        index, sizeof(std::uint64_t)));
+        });
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(hashes + i), hash);
+      }
+    }
+#endif
+    for (; i < n; i++)
+      hashes[i] = (*this)(keys[i], seed);
+  }
+};
+
+namespace detail {
+/**
+ * Scalar and AVX2 (four keys per vector) SipHash state. Both provide the same
+ * operations so SipHash13 runs one round implementation over either
+ */
+struct SipLanes {
+  std::uint64_t v;
+
+  static SipLanes set(std::uint64_t x) { return {x}; }
+  SipLanes operator+(SipLanes o) const { return {v + o.v}; }
+  SipLanes operator^(SipLanes o) const { return {v ^ o.v}; }
+  template <int R> SipLanes rotl() const { return {std::rotl(v, R)}; }
+};
+
+#ifdef __AVX2__
+struct SipLanesAVX2 {
+  __m256i v;
+
+  static SipLanesAVX2 set(std::uint64_t x) {
+    return {_mm256_set1_epi64x(static_cast<long long>(x))};
+  }
+  SipLanesAVX2 operator+(SipLanesAVX2 o) const {
+    return {_mm256_add_epi64(v, o.v)};
+  }
+  SipLanesAVX2 operator^(SipLanesAVX2 o) const {
+    return {_mm256_xor_si256(v, o.v)};
+  }
+  template <int R> SipLanesAVX2 rotl() const {
+    if constexpr (R == 32)
+      return {_mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1))};
+    else
+      return {_mm256_or_si256(_mm256_slli_epi64(v, R),
+                              _mm256_srli_epi64(v, 64 - R))};
+  }
+};
+#endif
+
+template <class Lanes> struct SipState {
+  Lanes v0, v1, v2, v3;
+
+  SipState(std::uint64_t k0, std::uint64_t k1)
+      : v0(Lanes::set(k0 ^ 0x736f6d6570736575ULL)),
+        v1(Lanes::set(k1 ^ 0x646f72616e646f6dULL)),
+        v2(Lanes::set(k0 ^ 0x6c7967656e657261ULL)),
+        v3(Lanes::set(k1 ^ 0x7465646279746573ULL)) {}
+
+  void round() {
+    v0 = v0 + v1;
+    v1 = v1.template rotl<13>() ^ v0;
+    v0 = v0.template rotl<32>();
+    v2 = v2 + v3;
+    v3 = v3.template rotl<16>() ^ v2;
+    v0 = v0 + v3;
+    v3 = v3.template rotl<21>() ^ v0;
+    v2 = v2 + v1;
+    v1 = v1.template rotl<17>() ^ v2;
+    v2 = v2.template rotl<32>();
+  }
+
+  // one compression round per message block
+  void compress(Lanes m) {
+    v3 = v3 ^ m;
+    round();
+    v0 = v0 ^ m;
+  }
+
+  // three finalization rounds
+  Lanes finalize() {
+    v2 = v2 ^ Lanes::set(0xFF);
+    round();
+    round();
+    round();
+    return v0 ^ v1 ^ v2 ^ v3;
+  }
+};
+} // namespace detail
+
+/**
+ * SipHash-1-3 keyed with a 128-bit secret, for keys from untrusted sources.
+ * Unkeyed hash functions let anyone who learns the seeds, e.g., through
+ * listSeeds() or serialized filters, craft keys that collide in a few buckets
+ * and thereby make listAll() fail. The secret is never derived from the seed
+ * and never exposed, so this does not apply to SipHash13.
+ *
+ * Default constructed instances draw their secret from std::random_device.
+ * Filters that are subtracted from or compared to one another must hash
+ * equally, hence construct them from copies of the same SipHash13 instance.
+ * FilterGroup compares secrets and rejects filters whose secret differs
+ */
+template <class Key> class SipHash13 {
+  static_assert(std::is_trivially_copyable_v<Key>);
+
+  // message blocks of a key, the last one carrying the key's length
+  static constexpr size_t blocks = sizeof(Key) / 8 + 1;
+
+  std::uint64_t k0, k1;
+
+  static std::array<std::uint64_t, blocks> split(const Key &key) {
+    std::array<std::uint64_t, blocks> m{};
+    std::memcpy(m.data(), &key, sizeof(Key));
+    m.back() |= std::uint64_t(sizeof(Key)) << 56;
+    return m;
+  }
+
+public:
+  SipHash13()
+      : SipHash13(std::uint64_t(std::random_device()()) << 32 |
+                      std::random_device()(),
+                  std::uint64_t(std::random_device()()) << 32 |
+                      std::random_device()()) {}
+
+  SipHash13(std::uint64_t k0, std::uint64_t k1) : k0(k0), k1(k1) {}
+
+  /**
+   * Instances hash equally iff their secrets are equal
+   */
+  bool operator==(const SipHash13 &) const = default;
+
+  /**
+   * Probes hash under the secret xor-ed with the probe's seed, which keeps
+   * probes independent without hashing the seed as an additional block
+   */
+  std::uint64_t operator()(const Key &key, std::uint64_t seed) const {
+    detail::SipState<detail::SipLanes> state(k0 ^ seed, k1);
+    for (const auto block : split(key))
+      state.compress({block});
+    return state.finalize().v;
+  }
+
+  /**
+   * Hashes n keys under seed, four keys per AVX2 vector if available
+   */
+  void hash_batch(const Key *keys, size_t n, std::uint64_t seed,
+                  std::uint64_t *hashes) const {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + 4 <= n; i += 4) {
+      std::array<std::array<std::uint64_t, blocks>, 4> m;
+      for (size_t j = 0; j < 4; j++)
+        m[j] = split(keys[i + j]);
+
+      detail::SipState<detail::SipLanesAVX2> state(k0 ^ seed, k1);
+      for (size_t b = 0; b < blocks; b++)
+        state.compress({_mm256_setr_epi64x(
+            static_cast<long long>(m[0][b]), static_cast<long long>(m[1][b]),
+            static_cast<long long>(m[2][b]),
+            static_cast<long long>(m[3][b]))});
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(hashes + i),
+                          state.finalize().v);
+    }
+#endif
+    for (; i < n; i++)
+      hashes[i] = (*this)(keys[i], seed);
+  }
+};
+
+/**
+ * Degree policy under which every key uses all K hash functions
+ */
+struct RegularDegree {
+  template <size_t K> static constexpr size_t degree(std::uint64_t) {
+    return K;
+  }
+
+  /**
+   * Fraction of keys using d hash functions, indexed by d
+   */
+  template <size_t K> static constexpr std::array<double, K + 1> degrees() {
+    std::array<double, K + 1> fractions{};
+    fractions[K] = 1;
+    return fractions;
+  }
+};
+
+/**
+ * Irregular degree policy: a hash chosen HighPercent percent of keys use all K
+ * hash functions, the remaining keys only the first Low ones. Keys with many
+ * buckets are likely to end up in a pure bucket early on, and peeling them
+ * relieves the low degree keys, which in turn cost less work per operation
+ */
+template <size_t Low, std::uint32_t HighPercent> struct MixedDegree {
+  static_assert(Low >= 1 && HighPercent <= 100);
+
+  template <size_t K> static constexpr size_t degree(std::uint64_t hash) {
+    static_assert(Low <= K);
+
+    // remixed, since bucket indices are derived from hash as well. Compared
+    // in 64 bits, as the threshold of HighPercent = 100 is 2^32
+    constexpr auto threshold = (std::uint64_t(HighPercent) << 32) / 100;
+    return (detail::mix(hash) & 0xFFFFFFFF) < threshold ? K : Low;
+  }
+
+  template <size_t K> static constexpr std::array<double, K + 1> degrees() {
+    std::array<double, K + 1> fractions{};
+    fractions[Low] += 1 - HighPercent / 100.0;
+    fractions[K] += HighPercent / 100.0;
+    return fractions;
+  }
+};
+
+namespace detail {
+/**
+ * Key stored in its lowest Bytes bytes only, e.g., as a bucket's cumulative
+ * key. Xor never sets bits outside the keys' domain, hence cumulative keys
+ * of keys below 2^(8 * Bytes) fit as well. Loads and stores go through
+ * memcpy, which compiles to a few unaligned loads and stores
+ */
+template <class Key, size_t Bytes> struct PackedKey {
+  static_assert(std::is_unsigned_v<Key> && Bytes <= sizeof(Key));
+  static_assert(std::endian::native == std::endian::little);
+
+  std::array<unsigned char, Bytes> bytes{};
+
+  PackedKey() = default;
+
+  explicit PackedKey(const Key &key) {
+    assert(Bytes == sizeof(Key) || key >> (8 * Bytes) == 0);
+    std::memcpy(bytes.data(), &key, Bytes);
+  }
+
+  operator Key() const {
+    Key key = 0;
+    std::memcpy(&key, bytes.data(), Bytes);
+    return key;
+  }
+
+  PackedKey &operator^=(const Key &key) {
+    return *this = PackedKey(Key(*this) ^ key);
+  }
+};
+} // namespace detail
+
+/**
+ * Key width policy storing cumulative keys as Key, i.e., at full width
+ */
+struct FullKeyWidth {
+  template <class Key> using Stored = Key;
+};
+
+/**
+ * Key width policy storing cumulative keys in their lowest Bits bits only,
+ * e.g., 40 bits for 40-bit ids held in std::uint64_t. Keys must be less than
+ * 2^Bits, which is only checked in debug builds. Buckets shrink accordingly,
+ * e.g., from 16 to 8 bytes for 40-bit keys with 16-bit counts
+ */
+template <size_t Bits> struct PackedKeyWidth {
+  static_assert(Bits > 0 && Bits % 8 == 0);
+
+  template <class Key> using Stored = detail::PackedKey<Key, Bits / 8>;
+};
+
+/**
+ * Value combiner xor-ing values into buckets. Works for any trivially
+ * copyable Value, see detail::xor_into()
+ */
+struct XorCombiner {
+  template <class Value> static void add(Value &sum, const Value &value) {
+    detail::xor_into(sum, value);
+  }
+  template <class Value> static void subtract(Value &sum, const Value &value) {
+    detail::xor_into(sum, value);
+  }
+};
+
+/**
+ * Value combiner summing values into buckets, wrapping around on overflow for
+ * unsigned Values. Recovered values are hence per key sums of the inserted
+ * value and all values accumulated into the key since, see
+ * InvertibleBloomDictionary::accumulate()
+ */
+struct AdditiveCombiner {
+  template <class Value> static void add(Value &sum, const Value &value) {
+    sum += value;
+  }
+  template <class Value> static void subtract(Value &sum, const Value &value) {
+    sum -= value;
+  }
+};
+
+/**
+ * Value combiner summing unsigned values modulo Prime into buckets. Values
+ * must be less than Prime
+ */
+template <std::uint64_t Prime> struct ModularCombiner {
+  static_assert(Prime > 1 && Prime <= (std::uint64_t(1) << 63));
+
+  template <class Value> static void add(Value &sum, const Value &value) {
+    static_assert(std::is_unsigned_v<Value> && sizeof(Value) <= 8);
+    assert(value < Prime);
+
+    // sum, value < Prime <= 2^63 never overflow 64 bits
+    auto result = std::uint64_t(sum) + value;
+    result -= result >= Prime ? Prime : 0;
+    sum = static_cast<Value>(result);
+  }
+  template <class Value> static void subtract(Value &sum, const Value &value) {
+    static_assert(std::is_unsigned_v<Value> && sizeof(Value) <= 8);
+    assert(value < Prime);
+
+    auto result = std::uint64_t(sum) + (Prime - value);
+    result -= result >= Prime ? Prime : 0;
+    sum = static_cast<Value>(result);
+  }
+};
+
+/**
+ * InvertibleBloomFilter is a probabilistic set data structure.
+ *
+ * It can do everything a normal bloom filter is capable of probabilistically
+ * recovering the original keyset. Copies are cheap snapshots: they share
+ * directory pages with the original until either side writes to them.
+ *
+ * Keys from a bounded domain, e.g., 40-bit ids, may be stored narrower than
+ * Key using PackedKeyWidth as KeyWidth
+ */
+template <class Key, class HashFn, size_t K = 3,
+          class BucketCounter = std::uint16_t,
+          class DegreePolicy = RegularDegree, class KeyWidth = FullKeyWidth>
+class InvertibleBloomFilter {
+  struct Bucket {
+    typename KeyWidth::template Stored<Key> cumulative_key{};
+    BucketCounter count = 0;
+  } /*__attribute((packed))*/;
+
+  HashFn hasher{};
+
+  using Seed = std::uint64_t;
+  std::array<Seed, K> seeds;
+
+  detail::PagedDirectory<Bucket> buckets;
+  size_t count;
+
+  /**
+   * Hash of key deciding its degree. Unseeded hash functions are only
+   * evaluated here, once per key, and seeded ones hash under the first probe's
+   * seed, which hash_index() reuses
+   */
+  std::uint64_t hash(const Key &key) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return hasher(key, seeds[0]);
+    else
+      return hasher(key);
+  }
+
+  /**
+   * Bucket index of key's i-th probe given its hash(), which seeded hash
+   * functions computed under the first probe's seed already
+   */
+  size_t hash_index(const Key &key, std::uint64_t hash, size_t i) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return detail::reduce(i == 0 ? hash : hasher(key, seeds[i]),
+                            buckets.size());
+    else
+      // only xor-ing hash with seed would merely permute the directory for
+      // power of two sizes, placing all probes of colliding keys together
+      return detail::reduce(detail::mix(hash ^ seeds[i]), buckets.size());
+  }
+
+  std::array<size_t, K> hash_indices(const Key &key) const {
+    const auto hash = this->hash(key);
+    const auto degree = DegreePolicy::template degree<K>(hash);
+
+    // probes beyond the key's degree repeat the first index, which updates
+    // then skip as duplicates
+    std::array<size_t, K> indices;
+    detail::unroll<K>([&](auto i) {
+      indices[i] = i < degree ? hash_index(key, hash, i) : indices[0];
+    });
+    return indices;
+  }
+
+  // keys hashed and prefetched at once by batched operations
+  static constexpr size_t batch_size = 32;
+
+  // most unknowns solve() eliminates, bounding it to 8 MiB of rows
+  static constexpr size_t max_solve_unknowns = 8192;
+
+  // fraction of keys by which peeling may lag behind its model before
+  // listAll(early_abort) gives up
+  static constexpr double abort_slack = 0.02;
+  // factor by which peeling may take more rounds than its model, as finite
+  // directories linger in the bottleneck near the threshold for a varying
+  // amount of rounds, which the model does not
+  static constexpr size_t abort_pace = 2;
+
+  /**
+   * Bucket indices of n <= batch_size keys. Batched hash functions hash all
+   * keys under one seed at a time
+   */
+  void hash_indices(const Key *keys, size_t n,
+                    std::array<size_t, K> *indices) const {
+    assert(n <= batch_size);
+    if constexpr (BatchedHashFn<HashFn, Key>) {
+      std::array<std::uint64_t, batch_size> hashes;
+      std::array<size_t, batch_size> degrees;
+      const auto size = buckets.size();
+      detail::unroll<K>([&](auto i) {
+        hasher.hash_batch(keys, n, seeds[i], hashes.data());
+        for (size_t j = 0; j < n; j++) {
+          if constexpr (i == 0)
+            degrees[j] = DegreePolicy::template degree<K>(hashes[j]);
+          const auto index = detail::reduce(hashes[j], size);
+          indices[j][i] = i < degrees[j] ? index : indices[j][0];
+        }
+      });
+    } else {
+      for (size_t j = 0; j < n; j++)
+        indices[j] = hash_indices(keys[j]);
+    }
+  }
+
+  void prefetch(const std::array<size_t, K> &indices) const {
+    for (const auto &index : indices)
+      __builtin_prefetch(&buckets[index]);
+  }
+
+  void insert(const Key &key, const std::array<size_t, K> &indices) {
+    const auto duplicates = detail::duplicate_probes(indices);
+
+    detail::unroll<K>([&](auto i) {
+      // fix issue with hashfn hashing to same slot
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      bucket.cumulative_key ^= key;
+      bucket.count++;
+    });
+
+    count += 1;
+  }
+
+  /**
+   * Removes key without checking whether it is contained
+   */
+  void erase(const Key &key, const std::array<size_t, K> &indices) {
+    const auto duplicates = detail::duplicate_probes(indices);
+
+    detail::unroll<K>([&](auto i) {
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      assert(bucket.count > 0);
+      bucket.cumulative_key ^= key;
+      bucket.count--;
+    });
+
+    count -= 1;
+  }
+
+  /**
+   * Inserts n keys, applying all their bucket updates sorted by bucket index.
+   * For large n this turns random accesses into a sweep over the directory
+   */
+  void insert_ordered(const Key *keys, size_t n,
+                      std::pmr::memory_resource *resource) {
+    std::pmr::vector<std::pair<size_t, Key>> updates(resource);
+    updates.reserve(n * K);
+    for (size_t i = 0; i < n; i++) {
+      const auto indices = hash_indices(keys[i]);
+      const auto duplicates = detail::duplicate_probes(indices);
+      detail::unroll<K>([&](auto j) {
+        if (((duplicates >> j) & 1) == 0)
+          updates.emplace_back(indices[j], keys[i]);
+      });
+    }
+    std::sort(updates.begin(), updates.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    for (const auto &[index, key] : updates) {
+      auto &bucket = buckets.mutate(index);
+      bucket.cumulative_key ^= key;
+      bucket.count++;
+    }
+    count += n;
+  }
+
+  ContainsResult contains(const Key &key,
+                          const std::array<size_t, K> &indices) const {
+    return detail::probe(buckets, indices, key).contains();
+  }
+
+  /**
+   * Peels a scratch copy of the directory, allocated from resource, calling
+   * emit for every recovered bucket. Returns whether all keys were recovered.
+   * Given a model_load, gives up once more keys remain after a round than
+   * peeling at that load would leave after abort_pace times fewer rounds, see
+   * detail::expected_remaining()
+   */
+  template <class Emit>
+  bool peel(std::pmr::memory_resource *resource, Emit &&emit,
+            std::optional<double> model_load = std::nullopt) const {
+    detail::Scratch<Bucket> scratch(buckets, resource);
+    return peel(scratch, emit, model_load);
+  }
+
+  /**
+   * Peels scratch in place, leaving the residual that could not be peeled
+   */
+  template <class Emit>
+  bool peel(detail::Scratch<Bucket> &scratch, Emit &&emit,
+            std::optional<double> model_load) const {
+    // directory indices of the pure buckets to peel this round and next
+    // round. Peeling a key queues the buckets it leaves pure for the next
+    // round, i.e., rounds peel generation by generation
+    std::pmr::vector<size_t> current(scratch.resource()),
+        next(scratch.resource());
+    for (size_t position = 0; position < scratch.size(); position++)
+      if (scratch[position].count == 1)
+        current.push_back(scratch.index(position));
+
+    // pure buckets are peeled in groups of batch_size. All buckets a group
+    // updates are prefetched before the first update, i.e., their cache
+    // misses overlap instead of forming a chain
+    std::array<Bucket, batch_size> pure;
+    std::array<std::array<size_t, K>, batch_size> indices;
+
+    size_t recovered = 0;
+    for (size_t rounds = 0; !current.empty(); rounds++) {
+      if (model_load && rounds > 0 && count > 0) {
+        const double remaining = double(count - recovered) / double(count);
+        // tolerate the model's error plus sampling noise of count keys
+        const double slack = abort_slack + 2 / std::sqrt(double(count));
+        if (remaining > detail::expected_remaining<K, DegreePolicy>(
+                            *model_load, rounds / abort_pace) +
+                            slack)
+          return false;
+      }
+
+      for (size_t offset = 0; offset < current.size(); offset += batch_size) {
+        const auto batch = std::min(batch_size, current.size() - offset);
+        for (size_t g = 0; g < batch; g++) {
+          pure[g] = scratch.at(current[offset + g]);
+          if (pure[g].count != 1)
+            continue;
+
+          indices[g] = hash_indices(pure[g].cumulative_key);
+          for (const auto index : indices[g])
+            scratch.prefetch(index);
+        }
+
+        for (size_t g = 0; g < batch; g++) {
+          // skip buckets emptied since, e.g., by an earlier key of the group
+          // sitting alone in several buckets, and buckets whose key does not
+          // hash to them
+          const auto i = current[offset + g];
+          if (pure[g].count != 1 || scratch.at(i).count != 1 ||
+              std::find(indices[g].begin(), indices[g].end(), i) ==
+                  indices[g].end())
+            continue;
+
+          const auto &bucket = pure[g];
+          emit(bucket);
+          recovered++;
+
+          const auto duplicates = detail::duplicate_probes(indices[g]);
+          detail::unroll<K>([&](auto j) {
+            if ((duplicates >> j) & 1)
+              return;
+
+            auto &other = scratch.at(indices[g][j]);
+            other.cumulative_key ^= bucket.cumulative_key;
+            other.count--;
+            if (other.count == 1)
+              next.push_back(indices[g][j]);
+          });
+          assert(scratch.at(i).count == 0);
+        }
+      }
+
+      std::swap(current, next);
+      next.clear();
+    }
+
+    if (recovered != count)
+      return false;
+    for (size_t position = 0; position < scratch.size(); position++)
+      if (scratch[position].count != 0)
+        return false;
+    return true;
+  }
+
+  /**
+   * Solves the residual scratch holds once peeling stalls by Gaussian
+   * elimination over GF(2). Its unknowns are whether each candidate touching
+   * only non-empty residual buckets is contained. Every residual bucket
+   * contributes one equation for its count's parity and one per bit of its
+   * cumulative key. Calls emit for every contained candidate. Returns false
+   * unless the candidates explain the residual uniquely
+   */
+  template <class Emit>
+  bool solve(detail::Scratch<Bucket> &scratch, const Key *candidates,
+             size_t n, Emit &&emit) const {
+    const auto occupied = [&](size_t i) {
+      const auto *bucket = scratch.find(i);
+      return bucket != nullptr && bucket->count != 0;
+    };
+
+    std::vector<Key> unknowns;
+    for (size_t i = 0; i < n; i++) {
+      const auto indices = hash_indices(candidates[i]);
+      if (std::all_of(indices.begin(), indices.end(), occupied))
+        unknowns.push_back(candidates[i]);
+    }
+    std::sort(unknowns.begin(), unknowns.end());
+    unknowns.erase(std::unique(unknowns.begin(), unknowns.end()),
+                   unknowns.end());
+    if (unknowns.size() > max_solve_unknowns)
+      return false;
+
+    // (bucket index, unknown) incidences, grouped by bucket
+    std::vector<std::pair<size_t, std::uint32_t>> incidences;
+    for (std::uint32_t u = 0; u < unknowns.size(); u++) {
+      const auto indices = hash_indices(unknowns[u]);
+      const auto duplicates = detail::duplicate_probes(indices);
+      detail::unroll<K>([&](auto j) {
+        if (!((duplicates >> j) & 1))
+          incidences.emplace_back(indices[j], u);
+      });
+    }
+    std::sort(incidences.begin(), incidences.end());
+
+    // every residual bucket must be touched by some unknown
+    size_t touched = 0;
+    for (size_t i = 0; i < incidences.size(); i++)
+      touched += i == 0 || incidences[i].first != incidences[i - 1].first;
+    size_t residual = 0;
+    for (size_t position = 0; position < scratch.size(); position++)
+      residual += scratch[position].count != 0;
+    if (touched != residual)
+      return false;
+
+    detail::GF2Elimination system(unknowns.size());
+    std::vector<std::uint64_t> row(system.row_words());
+    for (size_t begin = 0; begin < incidences.size();) {
+      auto end = begin;
+      while (end < incidences.size() &&
+             incidences[end].first == incidences[begin].first)
+        end++;
+      const auto &bucket = *scratch.find(incidences[begin].first);
+
+      // equation of the count's parity, then one per key bit
+      for (size_t bit = 0; bit <= 8 * sizeof(Key); bit++) {
+        std::fill(row.begin(), row.end(), 0);
+        for (auto i = begin; i < end; i++) {
+          const auto u = incidences[i].second;
+          if (bit == 0 || ((unknowns[u] >> (bit - 1)) & 1))
+            row[u / 64] |= std::uint64_t(1) << (u % 64);
+        }
+        const bool rhs = bit == 0 ? bucket.count & 1
+                                  : (bucket.cumulative_key >> (bit - 1)) & 1;
+        if (!system.add(row.data(), rhs))
+          return false;
+      }
+      begin = end;
+    }
+    if (system.rank() != unknowns.size())
+      return false;
+
+    // verify the solution against the residual's counts and keys
+    const auto x = system.solve();
+    for (size_t u = 0; u < unknowns.size(); u++) {
+      if (!x[u])
+        continue;
+
+      const auto indices = hash_indices(unknowns[u]);
+      const auto duplicates = detail::duplicate_probes(indices);
+      detail::unroll<K>([&](auto j) {
+        if ((duplicates >> j) & 1)
+          return;
+
+        auto &bucket = *scratch.find(indices[j]);
+        bucket.cumulative_key ^= unknowns[u];
+        bucket.count--;
+      });
+    }
+    for (size_t position = 0; position < scratch.size(); position++)
+      if (scratch[position].count != 0 ||
+          scratch[position].cumulative_key != Key{})
+        return false;
+
+    for (size_t u = 0; u < unknowns.size(); u++)
+      if (x[u])
+        emit(unknowns[u]);
+    return true;
+  }
+
+  template <class Filter> friend class FilterGroup;
+  template <class Filter> friend class TwoTierFilter;
+  template <class Filter> friend class StashedFilter;
+
+public:
+  using key_type = Key;
+
+  // bytes each directory bucket takes
+  static constexpr size_t bucket_bytes = sizeof(Bucket);
+
+  /**
+   * Constructs and InvertibleBloomFilter given a target directory size and
+   * seed (defaults to std::random_device()()). Note that the directory never
+   * resizes during InvertibleBloomFilter's lifetime, hence you must pick a
+   * value that fits your keys upfront
+   */
+  InvertibleBloomFilter(size_t size, unsigned int seed = std::random_device()())
+      : buckets(size), count(0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Constructs an InvertibleBloomFilter with a sparse directory, which only
+   * stores buckets once written. Intended for huge directory sizes holding
+   * few keys, e.g., to share a directory size with much fuller filters. Turns
+   * dense once that takes less memory
+   */
+  InvertibleBloomFilter(size_t size, sparse_t,
+                        unsigned int seed = std::random_device()())
+      : buckets(size, sparse), count(0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Constructs an InvertibleBloomFilter hashing with the given hasher, e.g., a
+   * SipHash13 keyed with a secret. Reseedable hash functions are still
+   * reseeded with seed
+   */
+  InvertibleBloomFilter(size_t size, HashFn hasher,
+                        unsigned int seed = std::random_device()())
+      : hasher(std::move(hasher)), buckets(size), count(0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(this->hasher, seed, seeds);
+  }
+
+  /**
+   * Count of keys in this InvertibleBloomFilter
+   */
+  size_t size() const { return count; }
+
+  /**
+   * Size of internal bucket directory
+   */
+  size_t directory_size() const { return buckets.size(); }
+
+  /**
+   * Whether the directory currently only stores written buckets
+   */
+  bool is_sparse() const { return buckets.is_sparse(); }
+
+  /**
+   * Exposes internally used seeds, useful for testing or external serialization
+   */
+  std::array<Seed, K> listSeeds() const { return seeds; }
+
+  /**
+   * Removes all keys from this InvertibleBloomFilter without reallocating
+   * its directory
+   */
+  void clear() {
+    buckets.clear();
+    count = 0;
+  }
+
+  /**
+   * Removes all keys and reseeds this InvertibleBloomFilter in place, i.e.,
+   * the result is equivalent to a freshly constructed InvertibleBloomFilter
+   * with the same directory size and seed. Unlike construction this neither
+   * allocates nor queries std::random_device, which allows recycling filters
+   */
+  void reset(unsigned int seed) {
+    clear();
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Inserts a single key with its corresponding value
+   */
+  void insert(const Key &key) { insert(key, hash_indices(key)); }
+
+  /**
+   * Inserts n keys, hashing and prefetching their buckets in batches
+   */
+  void insert(const Key *keys, size_t n) {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        insert(keys[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Checks whether a key is contained in this IBF. May return false positives,
+   * but never false negatives
+   */
+  ContainsResult contains(const Key &key) const {
+    const auto hash = this->hash(key);
+
+    // probing lazily with an early exit is measurably faster than loading all
+    // K buckets upfront (detail::probe), since the first probed bucket
+    // frequently decides the result already
+    bool might_exist = false;
+    const auto degree = DegreePolicy::template degree<K>(hash);
+    for (size_t i = 0; i < degree; i++) {
+      const auto &bucket = buckets[hash_index(key, hash, i)];
+      if (bucket.count == 1)
+        return key == bucket.cumulative_key ? ContainsResult::exists
+                                            : ContainsResult::not_found;
+
+      might_exist |= bucket.count > 1;
+    }
+
+    return might_exist ? ContainsResult::might_exist
+                       : ContainsResult::not_found;
+  }
+
+  /**
+   * Checks whether n keys are contained, writing results[i] for keys[i].
+   * Hashes and prefetches the buckets of keys in batches
+   */
+  void contains(const Key *keys, size_t n, ContainsResult *results) const {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        results[offset + i] = contains(keys[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Removes a single key and its corresponding value from
+   * the struct. Note that it is possible for this operation
+   * to fail (return false) not because the key doesn't exist,
+   * but because it is not uniquely identifyable
+   */
+  bool remove(Key key) {
+    const auto indices = hash_indices(key);
+    if (contains(key, indices) != ContainsResult::exists)
+      return false;
+
+    const auto duplicates = detail::duplicate_probes(indices);
+    detail::unroll<K>([&](auto i) {
+      // fix issue with hashfn hashing to same slot
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      assert(bucket.count > 0);
+
+      bucket.cumulative_key ^= key;
+      bucket.count--;
+    });
+
+    count -= 1;
+    return true;
+  }
+
+  /**
+   * Removes a single key known to be contained, e.g., because the caller
+   * inserted it, without verifying that it is. Unlike remove() this succeeds
+   * even if none of key's buckets is pure. Erasing a key that is not
+   * contained corrupts this InvertibleBloomFilter
+   */
+  void erase(const Key &key) { erase(key, hash_indices(key)); }
+
+  /**
+   * Erases n keys known to be contained, hashing and prefetching their
+   * buckets in batches
+   */
+  void erase(const Key *keys, size_t n) {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        erase(keys[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Attempts to retrieve all key, value pairs. This operation might fail
+   * due to the probabilistic nature of this struct
+   */
+  std::optional<std::unordered_set<Key>> listAll() const {
+    std::unordered_set<Key> res;
+    res.reserve(count);
+
+    if (!peel(std::pmr::new_delete_resource(),
+              [&](const Bucket &bucket) { res.insert(bucket.cumulative_key); }))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Like listAll(), except that all decoding scratch memory as well as the
+   * result are allocated from resource. Repeated decodes can thereby reuse,
+   * e.g., a single std::pmr::monotonic_buffer_resource and never touch the
+   * global allocator
+   */
+  std::optional<std::pmr::unordered_set<Key>>
+  listAll(std::pmr::memory_resource *resource) const {
+    std::pmr::unordered_set<Key> res(resource);
+    res.reserve(count);
+
+    if (!peel(resource,
+              [&](const Bucket &bucket) { res.insert(bucket.cumulative_key); }))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Estimates this InvertibleBloomFilter's keys and whether they will decode
+   * from the occupancy of its directory alone, i.e., without peeling
+   */
+  DecodeEstimate estimate() const {
+    const auto [empty, pure] = detail::occupancy(buckets);
+    return detail::estimate_decode<K, DegreePolicy>(buckets.size(), empty,
+                                                    pure);
+  }
+
+  /**
+   * Like listAll(), except that it fails without peeling if estimate()
+   * predicts failure, and while peeling as soon as progress falls behind what
+   * the estimated load plus one standard error leads to expect. Allows
+   * escalating to a larger filter early, at the cost of rarely failing on
+   * filters listAll() would decode
+   */
+  std::optional<std::unordered_set<Key>> listAll(early_abort_t) const {
+    const auto estimate = this->estimate();
+    if (!estimate.peelable)
+      return std::nullopt;
+
+    std::unordered_set<Key> res;
+    res.reserve(count);
+
+    if (!peel(std::pmr::new_delete_resource(),
+              [&](const Bucket &bucket) { res.insert(bucket.cumulative_key); },
+              estimate.load + estimate.error))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Like listAll(), except that keys left once peeling stalls are solved for
+   * among candidates, e.g., keys known to the decoding side, by Gaussian
+   * elimination over GF(2). Allows decoding filters beyond the peeling
+   * threshold, as long as candidates contains all keys peeling leaves and
+   * the system of their at most max_solve_unknowns unknowns has full rank
+   */
+  std::optional<std::unordered_set<Key>>
+  listAll(const Key *candidates, size_t n) const {
+    std::unordered_set<Key> res;
+    res.reserve(count);
+
+    detail::Scratch<Bucket> scratch(buckets, std::pmr::new_delete_resource());
+    const auto insert = [&](const Key &key) { res.insert(key); };
+    if (!peel(
+            scratch, [&](const Bucket &bucket) { insert(bucket.cumulative_key); },
+            std::nullopt) &&
+        !solve(scratch, candidates, n, insert))
+      return std::nullopt;
+    if (res.size() != count)
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+};
+
+template <class Key, class HashFn, class BucketCounter = std::uint16_t,
+          class Ks = std::index_sequence<2, 3, 4, 5, 6>>
+class RuntimeKInvertibleBloomFilter;
+
+/**
+ * InvertibleBloomFilter whose amount of hash functions K is picked at runtime
+ * from Ks, e.g., by auto sizing, without callers templating on K. Holds an
+ * InvertibleBloomFilter specialized for the picked K, i.e., with fully
+ * unrolled probe loops, and dispatches each call to it through std::visit's
+ * jump table. Batched operations hence dispatch once per batch
+ */
+template <class Key, class HashFn, class BucketCounter, size_t... Ks>
+class RuntimeKInvertibleBloomFilter<Key, HashFn, BucketCounter,
+                                    std::index_sequence<Ks...>> {
+  static_assert(sizeof...(Ks) > 0);
+
+  using Filter =
+      std::variant<InvertibleBloomFilter<Key, HashFn, Ks, BucketCounter>...>;
+  Filter filter;
+
+  static constexpr std::array<size_t, sizeof...(Ks)> ks{Ks...};
+
+  template <size_t K> static constexpr size_t index_of() {
+    return std::find(ks.begin(), ks.end(), K) - ks.begin();
+  }
+
+  static Filter make_filter(size_t size, size_t k, const HashFn &hasher,
+                            unsigned int seed) {
+    assert(supports(k));
+
+    // one constructor per supported K, unsupported ones (without assertions)
+    // fall back to the first
+    constexpr std::array<Filter (*)(size_t, const HashFn &, unsigned int),
+                         sizeof...(Ks)>
+        constructors{[](size_t size, const HashFn &hasher, unsigned int seed) {
+          return Filter(std::in_place_index<index_of<Ks>()>, size, hasher,
+                        seed);
+        }...};
+    const size_t index = std::find(ks.begin(), ks.end(), k) - ks.begin();
+    return constructors[index < ks.size() ? index : 0](size, hasher, seed);
+  }
+
+public:
+  using key_type = Key;
+
+  /**
+   * Whether k is one of the supported amounts of hash functions Ks
+   */
+  static constexpr bool supports(size_t k) { return ((k == Ks) || ...); }
+
+  /**
+   * Constructs a filter with k hash functions, which must be one of Ks, see
+   * InvertibleBloomFilter's constructor
+   */
+  RuntimeKInvertibleBloomFilter(size_t size, size_t k,
+                                unsigned int seed = std::random_device()())
+      : filter(make_filter(size, k, HashFn(), seed)) {}
+
+  /**
+   * Constructs a filter with k hash functions hashing with hasher, e.g., a
+   * SipHash13 keyed with a secret
+   */
+  RuntimeKInvertibleBloomFilter(size_t size, size_t k, const HashFn &hasher,
+                                unsigned int seed = std::random_device()())
+      : filter(make_filter(size, k, hasher, seed)) {}
+
+  /**
+   * Amount of hash functions of this filter
+   */
+  size_t k() const { return ks[filter.index()]; }
+
+  size_t size() const {
+    return std::visit([](const auto &f) { return f.size(); }, filter);
+  }
+
+  size_t directory_size() const {
+    return std::visit([](const auto &f) { return f.directory_size(); },
+                      filter);
+  }
+
+  std::vector<std::uint64_t> listSeeds() const {
+    return std::visit(
+        [](const auto &f) {
+          const auto seeds = f.listSeeds();
+          return std::vector<std::uint64_t>(seeds.begin(), seeds.end());
+        },
+        filter);
+  }
+
+  void clear() {
+    std::visit([](auto &f) { f.clear(); }, filter);
+  }
+
+  void reset(unsigned int seed) {
+    std::visit([&](auto &f) { f.reset(seed); }, filter);
+  }
+
+  void insert(const Key &key) {
+    std::visit([&](auto &f) { f.insert(key); }, filter);
+  }
+
+  void insert(const Key *keys, size_t n) {
+    std::visit([&](auto &f) { f.insert(keys, n); }, filter);
+  }
+
+  ContainsResult contains(const Key &key) const {
+    return std::visit([&](const auto &f) { return f.contains(key); }, filter);
+  }
+
+  void contains(const Key *keys, size_t n, ContainsResult *results) const {
+    std::visit([&](const auto &f) { f.contains(keys, n, results); }, filter);
+  }
+
+  bool remove(const Key &key) {
+    return std::visit([&](auto &f) { return f.remove(key); }, filter);
+  }
+
+  void erase(const Key &key) {
+    std::visit([&](auto &f) { f.erase(key); }, filter);
+  }
+
+  void erase(const Key *keys, size_t n) {
+    std::visit([&](auto &f) { f.erase(keys, n); }, filter);
+  }
+
+  std::optional<std::unordered_set<Key>> listAll() const {
+    return std::visit([](const auto &f) { return f.listAll(); }, filter);
+  }
+
+  std::optional<std::pmr::unordered_set<Key>>
+  listAll(std::pmr::memory_resource *resource) const {
+    return std::visit([&](const auto &f) { return f.listAll(resource); },
+                      filter);
+  }
+};
+
+/**
+ * InvertibleBloomDictionary is a probabilistic dictionary data structure.
+ *
+ * It can do everything a normal bloom filter is capable of and, with a certain
+ * probability < 1, recover associated values and also the original keyset.
+ * Copies are cheap snapshots: they share directory pages with the original
+ * until either side writes to them.
+ *
+ * Value may be any trivially copyable type, e.g., a struct of several fields,
+ * as long as Value{} consists of zero bytes only. ValueCombiner decides how
+ * values are combined within buckets (XorCombiner, AdditiveCombiner,
+ * ModularCombiner). KeyWidth decides how wide cumulative keys are stored
+ * (FullKeyWidth, PackedKeyWidth).
+ *
+ * Each key may only be inserted once at a time: inserting a key twice cancels
+ * it out of the key sums while counting it twice, which breaks decoding.
+ * Aggregating values per key hence inserts a key once and combines every
+ * further value into it using accumulate()
+ */
+template <class Key, class Value, class HashFn, size_t K = 3,
+          class BucketCounter = std::uint16_t,
+          class DegreePolicy = RegularDegree,
+          class ValueCombiner = XorCombiner, class KeyWidth = FullKeyWidth>
+class InvertibleBloomDictionary {
+  struct Bucket {
+    typename KeyWidth::template Stored<Key> cumulative_key{};
+    Value cumulative_value{};
+    BucketCounter count = 0;
+  } /*__attribute((packed))*/;
+
+  HashFn hasher{};
+
+  using Seed = std::uint64_t;
+  std::array<Seed, K> seeds;
+
+  detail::PagedDirectory<Bucket> buckets;
+  size_t count;
+
+  /**
+   * Hash of key deciding its degree. Unseeded hash functions are only
+   * evaluated here, once per key, and seeded ones hash under the first probe's
+   * seed, which hash_index() reuses
+   */
+  std::uint64_t hash(const Key &key) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return hasher(key, seeds[0]);
+    else
+      return hasher(key);
+  }
+
+  /**
+   * Bucket index of key's i-th probe given its hash(), which seeded hash
+   * functions computed under the first probe's seed already
+   */
+  size_t hash_index(const Key &key, std::uint64_t hash, size_t i) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return detail::reduce(i == 0 ? hash : hasher(key, seeds[i]),
+                            buckets.size());
+    else
+      // only xor-ing hash with seed would merely permute the directory for
+      // power of two sizes, placing all probes of colliding keys together
+      return detail::reduce(detail::mix(hash ^ seeds[i]), buckets.size());
+  }
+
+  std::array<size_t, K> hash_indices(const Key &key) const {
+    return hash_indices(key, hash(key));
+  }
+
+  std::array<size_t, K> hash_indices(const Key &key,
+                                     std::uint64_t hash) const {
+    const auto degree = DegreePolicy::template degree<K>(hash);
+
+    // probes beyond the key's degree repeat the first index, which updates
+    // then skip as duplicates
+    std::array<size_t, K> indices;
+    detail::unroll<K>([&](auto i) {
+      indices[i] = i < degree ? hash_index(key, hash, i) : indices[0];
+    });
+    return indices;
+  }
+
+  // keys hashed and prefetched at once by batched operations
+  static constexpr size_t batch_size = 32;
+
+  // fraction of keys by which peeling may lag behind its model before
+  // listAll(early_abort) gives up
+  static constexpr double abort_slack = 0.02;
+  // factor by which peeling may take more rounds than its model, as finite
+  // directories linger in the bottleneck near the threshold for a varying
+  // amount of rounds, which the model does not
+  static constexpr size_t abort_pace = 2;
+
+  /**
+   * Bucket indices of n <= batch_size keys. Batched hash functions hash all
+   * keys under one seed at a time. Writes each key's hash() to key_hashes
+   * unless null, e.g., for FlowEncoder to derive its flow set probes
+   */
+  void hash_indices(const Key *keys, size_t n, std::array<size_t, K> *indices,
+                    std::uint64_t *key_hashes = nullptr) const {
+    assert(n <= batch_size);
+    if constexpr (BatchedHashFn<HashFn, Key>) {
+      std::array<std::uint64_t, batch_size> hashes;
+      std::array<size_t, batch_size> degrees;
+      const auto size = buckets.size();
+      detail::unroll<K>([&](auto i) {
+        hasher.hash_batch(keys, n, seeds[i], hashes.data());
+        if constexpr (i == 0)
+          if (key_hashes)
+            std::copy_n(hashes.data(), n, key_hashes);
+        for (size_t j = 0; j < n; j++) {
+          if constexpr (i == 0)
+            degrees[j] = DegreePolicy::template degree<K>(hashes[j]);
+          const auto index = detail::reduce(hashes[j], size);
+          indices[j][i] = i < degrees[j] ? index : indices[j][0];
+        }
+      });
+    } else {
+      for (size_t j = 0; j < n; j++) {
+        const auto hash = this->hash(keys[j]);
+        if (key_hashes)
+          key_hashes[j] = hash;
+        indices[j] = hash_indices(keys[j], hash);
+      }
+    }
+  }
+
+  void prefetch(const std::array<size_t, K> &indices) const {
+    for (const auto &index : indices)
+      __builtin_prefetch(&buckets[index]);
+  }
+
+  void insert(const Key &key, const Value &value,
+              const std::array<size_t, K> &indices) {
+    const auto duplicates = detail::duplicate_probes(indices);
+
+    detail::unroll<K>([&](auto i) {
+      // fix issue with hashfn hashing to same slot
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      bucket.cumulative_key ^= key;
+      ValueCombiner::add(bucket.cumulative_value, value);
+      bucket.count++;
+    });
+
+    count += 1;
+  }
+
+  void erase(const Key &key, const Value &value,
+             const std::array<size_t, K> &indices) {
+    const auto duplicates = detail::duplicate_probes(indices);
+
+    detail::unroll<K>([&](auto i) {
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      assert(bucket.count > 0);
+      bucket.cumulative_key ^= key;
+      ValueCombiner::subtract(bucket.cumulative_value, value);
+      bucket.count--;
+    });
+
+    count -= 1;
+  }
+
+  void accumulate(const Key &key, const Value &value,
+                  const std::array<size_t, K> &indices) {
+    // an empty bucket, or a pure one holding another key, proves key absent
+    const auto masks = detail::probe(buckets, indices, key);
+    constexpr auto all_probes = ~std::uint32_t(0) >> (32 - K);
+    if ((masks.pure | masks.ambiguous) != all_probes ||
+        (masks.pure & ~masks.match) != 0) {
+      insert(key, value, indices);
+      return;
+    }
+
+    const auto duplicates = detail::duplicate_probes(indices);
+    detail::unroll<K>([&](auto i) {
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      ValueCombiner::add(bucket.cumulative_value, value);
+    });
+  }
+
+  ContainsResult contains(const Key &key,
+                          const std::array<size_t, K> &indices) const {
+    return detail::probe(buckets, indices, key).contains();
+  }
+
+  std::optional<Value> get(const Key &key,
+                           const std::array<size_t, K> &indices) const {
+    const auto masks = detail::probe(buckets, indices, key);
+    if (masks.contains() != ContainsResult::exists)
+      return std::nullopt;
+    return buckets[indices[masks.deciding_probe()]].cumulative_value;
+  }
+
+  /**
+   * Peels a scratch copy of the directory, allocated from resource, calling
+   * emit for every recovered bucket. Returns whether all keys were recovered.
+   * Given a model_load, gives up once more keys remain after a round than
+   * peeling at that load would leave after abort_pace times fewer rounds, see
+   * detail::expected_remaining()
+   */
+  template <class Emit>
+  bool peel(std::pmr::memory_resource *resource, Emit &&emit,
+            std::optional<double> model_load = std::nullopt) const {
+    detail::Scratch<Bucket> scratch(buckets, resource);
+    return peel(scratch, emit, model_load);
+  }
+
+  /**
+   * Peels scratch in place, leaving the residual that could not be peeled
+   */
+  template <class Emit>
+  bool peel(detail::Scratch<Bucket> &scratch, Emit &&emit,
+            std::optional<double> model_load) const {
+    // directory indices of the pure buckets to peel this round and next
+    // round. Peeling a key queues the buckets it leaves pure for the next
+    // round, i.e., rounds peel generation by generation
+    std::pmr::vector<size_t> current(scratch.resource()),
+        next(scratch.resource());
+    for (size_t position = 0; position < scratch.size(); position++)
+      if (scratch[position].count == 1)
+        current.push_back(scratch.index(position));
+
+    // pure buckets are peeled in groups of batch_size. All buckets a group
+    // updates are prefetched before the first update, i.e., their cache
+    // misses overlap instead of forming a chain
+    std::array<Bucket, batch_size> pure;
+    std::array<std::array<size_t, K>, batch_size> indices;
+
+    size_t recovered = 0;
+    for (size_t rounds = 0; !current.empty(); rounds++) {
+      if (model_load && rounds > 0 && count > 0) {
+        const double remaining = double(count - recovered) / double(count);
+        // tolerate the model's error plus sampling noise of count keys
+        const double slack = abort_slack + 2 / std::sqrt(double(count));
+        if (remaining > detail::expected_remaining<K, DegreePolicy>(
+                            *model_load, rounds / abort_pace) +
+                            slack)
+          return false;
+      }
+
+      for (size_t offset = 0; offset < current.size(); offset += batch_size) {
+        const auto batch = std::min(batch_size, current.size() - offset);
+        for (size_t g = 0; g < batch; g++) {
+          pure[g] = scratch.at(current[offset + g]);
+          if (pure[g].count != 1)
+            continue;
+
+          indices[g] = hash_indices(pure[g].cumulative_key);
+          for (const auto index : indices[g])
+            scratch.prefetch(index);
+        }
+
+        for (size_t g = 0; g < batch; g++) {
+          // skip buckets emptied since, e.g., by an earlier key of the group
+          // sitting alone in several buckets, and buckets whose key does not
+          // hash to them
+          const auto i = current[offset + g];
+          if (pure[g].count != 1 || scratch.at(i).count != 1 ||
+              std::find(indices[g].begin(), indices[g].end(), i) ==
+                  indices[g].end())
+            continue;
+
+          const auto &bucket = pure[g];
+          emit(bucket);
+          recovered++;
+
+          const auto duplicates = detail::duplicate_probes(indices[g]);
+          detail::unroll<K>([&](auto j) {
+            if ((duplicates >> j) & 1)
+              return;
+
+            auto &other = scratch.at(indices[g][j]);
+            other.cumulative_key ^= bucket.cumulative_key;
+            ValueCombiner::subtract(other.cumulative_value,
+                                    bucket.cumulative_value);
+            other.count--;
+            if (other.count == 1)
+              next.push_back(indices[g][j]);
+          });
+          assert(scratch.at(i).count == 0);
+        }
+      }
+
+      std::swap(current, next);
+      next.clear();
+    }
+
+    if (recovered != count)
+      return false;
+    for (size_t position = 0; position < scratch.size(); position++)
+      if (scratch[position].count != 0)
+        return false;
+    return true;
+  }
+
+  template <class Filter> friend class FilterGroup;
+  template <class, class, class, size_t, class> friend class FlowEncoder;
+  template <class Dictionary> friend class FrozenDictionary;
+
+public:
+  using key_type = Key;
+
+  // bytes each directory bucket takes
+  static constexpr size_t bucket_bytes = sizeof(Bucket);
+
+  /**
+   * Constructs and InvertibleBloomDictionary given a target directory size and
+   * seed (defaults to std::random_device()()). Note that the directory never
+   * resizes during InvertibleBloomDictionary's lifetime, hence you must pick a
+   * value that fits your keys upfront
+   */
+  InvertibleBloomDictionary(size_t size,
+                            unsigned int seed = std::random_device()())
+      : buckets(size), count(0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Constructs an InvertibleBloomDictionary with a sparse directory, see
+   * InvertibleBloomFilter's equivalent constructor
+   */
+  InvertibleBloomDictionary(size_t size, sparse_t,
+                            unsigned int seed = std::random_device()())
+      : buckets(size, sparse), count(0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Constructs an InvertibleBloomDictionary hashing with the given hasher, see
+   * InvertibleBloomFilter's equivalent constructor
+   */
+  InvertibleBloomDictionary(size_t size, HashFn hasher,
+                            unsigned int seed = std::random_device()())
+      : hasher(std::move(hasher)), buckets(size), count(0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(this->hasher, seed, seeds);
+  }
+
+  /**
+   * Count of keys in this InvertibleBloomDictionary
+   */
+  size_t size() const { return count; }
+
+  /**
+   * Size of internal bucket directory
+   */
+  size_t directory_size() const { return buckets.size(); }
+
+  /**
+   * Whether the directory currently only stores written buckets
+   */
+  bool is_sparse() const { return buckets.is_sparse(); }
+
+  /**
+   * Exposes internally used seeds, useful for testing or external serialization
+   */
+  std::array<Seed, K> listSeeds() const { return seeds; }
+
+  /**
+   * Removes all keys from this InvertibleBloomDictionary without reallocating
+   * its directory
+   */
+  void clear() {
+    buckets.clear();
+    count = 0;
+  }
+
+  /**
+   * Removes all keys and reseeds this InvertibleBloomDictionary in place, i.e.,
+   * the result is equivalent to a freshly constructed InvertibleBloomDictionary
+   * with the same directory size and seed. Unlike construction this neither
+   * allocates nor queries std::random_device, which allows recycling filters
+   */
+  void reset(unsigned int seed) {
+    clear();
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Inserts a single key, which must not be contained yet, with its
+   * corresponding value
+   */
+  void insert(const Key &key, const Value &value) {
+    insert(key, value, hash_indices(key));
+  }
+
+  /**
+   * Inserts n keys with their corresponding values, hashing and prefetching
+   * their buckets in batches
+   */
+  void insert(const Key *keys, const Value *values, size_t n) {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        insert(keys[offset + i], values[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Checks whether a key is contained in this IBF. May return false positives,
+   * but never false negatives
+   */
+  ContainsResult contains(const Key &key) const {
+    const auto hash = this->hash(key);
+
+    // see InvertibleBloomFilter::contains() on why this probes lazily
+    bool might_exist = false;
+    const auto degree = DegreePolicy::template degree<K>(hash);
+    for (size_t i = 0; i < degree; i++) {
+      const auto &bucket = buckets[hash_index(key, hash, i)];
+      if (bucket.count == 1)
+        return key == bucket.cumulative_key ? ContainsResult::exists
+                                            : ContainsResult::not_found;
+
+      might_exist |= bucket.count > 1;
+    }
+
+    return might_exist ? ContainsResult::might_exist
+                       : ContainsResult::not_found;
+  }
+
+  /**
+   * Checks whether n keys are contained, writing results[i] for keys[i].
+   * Hashes and prefetches the buckets of keys in batches
+   */
+  void contains(const Key *keys, size_t n, ContainsResult *results) const {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        results[offset + i] = contains(keys[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Returns the value associated with key if retrievable.
+   * Can return nullopt, eiher if key does not exist or if it's value is not
+   * uniquely identifyable.
+   */
+  std::optional<Value> get(const Key &key) const {
+    const auto hash = this->hash(key);
+
+    const auto degree = DegreePolicy::template degree<K>(hash);
+    for (size_t i = 0; i < degree; i++) {
+      const auto &bucket = buckets[hash_index(key, hash, i)];
+      if (bucket.count == 1)
+        return key == bucket.cumulative_key
+                   ? std::make_optional(bucket.cumulative_value)
+                   : std::nullopt;
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * Removes a single key and its corresponding value from
+   * the struct. Note that it is possible for this operation
+   * to fail (return false) not because the key doesn't exist,
+   * but because it is not uniquely identifyable
+   */
+  bool remove(Key key) {
+    const auto indices = hash_indices(key);
+    const auto value = get(key, indices);
+    if (!value)
+      return false;
+    assert(value.has_value());
+
+    const auto duplicates = detail::duplicate_probes(indices);
+    detail::unroll<K>([&](auto i) {
+      // fix issue with hashfn hashing to same slot
+      if ((duplicates >> i) & 1)
+        return;
+
+      auto &bucket = buckets.mutate(indices[i]);
+      assert(bucket.count > 0);
+
+      bucket.cumulative_key ^= key;
+      ValueCombiner::subtract(bucket.cumulative_value, *value);
+      bucket.count--;
+    });
+
+    count -= 1;
+    return true;
+  }
+
+  /**
+   * Removes a single key with its value, both known to be contained, without
+   * verifying that they are. See InvertibleBloomFilter::erase()
+   */
+  void erase(const Key &key, const Value &value) {
+    erase(key, value, hash_indices(key));
+  }
+
+  /**
+   * Erases n keys with their values, all known to be contained, hashing and
+   * prefetching their buckets in batches
+   */
+  void erase(const Key *keys, const Value *values, size_t n) {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        erase(keys[offset + i], values[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Combines value into the value of key, which should be contained, e.g., to
+   * sum up values per key with AdditiveCombiner. Neither the key sums nor the
+   * counts change, hence decoding recovers the combined value. Keys whose
+   * buckets prove them absent (an empty bucket, or a pure one holding another
+   * key) are inserted with value instead. Absent keys all of whose buckets
+   * hold several keys go unnoticed, and their value ends up in the values of
+   * other keys
+   */
+  void accumulate(const Key &key, const Value &value) {
+    accumulate(key, value, hash_indices(key));
+  }
+
+  /**
+   * Accumulates n values into their keys, hashing and prefetching their
+   * buckets in batches
+   */
+  void accumulate(const Key *keys, const Value *values, size_t n) {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      hash_indices(keys + offset, batch, indices.data());
+      for (size_t i = 0; i < batch; i++)
+        prefetch(indices[i]);
+      for (size_t i = 0; i < batch; i++)
+        accumulate(keys[offset + i], values[offset + i], indices[i]);
+    }
+  }
+
+  /**
+   * Attempts to retrieve all key, value pairs. This operation might fail
+   * due to the probabilistic nature of this struct
+   */
+  std::optional<std::vector<std::pair<Key, Value>>> listAll() const {
+    std::vector<std::pair<Key, Value>> res;
+    res.reserve(count);
+
+    if (!peel(std::pmr::new_delete_resource(), [&](const Bucket &bucket) {
+          res.push_back({bucket.cumulative_key, bucket.cumulative_value});
+        }))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Like listAll(), except that all decoding scratch memory as well as the
+   * result are allocated from resource. Repeated decodes can thereby reuse,
+   * e.g., a single std::pmr::monotonic_buffer_resource and never touch the
+   * global allocator
+   */
+  std::optional<std::pmr::vector<std::pair<Key, Value>>>
+  listAll(std::pmr::memory_resource *resource) const {
+    std::pmr::vector<std::pair<Key, Value>> res(resource);
+    res.reserve(count);
+
+    if (!peel(resource, [&](const Bucket &bucket) {
+          res.push_back({bucket.cumulative_key, bucket.cumulative_value});
+        }))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Estimates this InvertibleBloomDictionary's keys and whether they will
+   * decode, see InvertibleBloomFilter::estimate()
+   */
+  DecodeEstimate estimate() const {
+    const auto [empty, pure] = detail::occupancy(buckets);
+    return detail::estimate_decode<K, DegreePolicy>(buckets.size(), empty,
+                                                    pure);
+  }
+
+  /**
+   * Like listAll(), except that it gives up early on dictionaries unlikely to
+   * decode, see InvertibleBloomFilter::listAll(early_abort_t)
+   */
+  std::optional<std::vector<std::pair<Key, Value>>>
+  listAll(early_abort_t) const {
+    const auto estimate = this->estimate();
+    if (!estimate.peelable)
+      return std::nullopt;
+
+    std::vector<std::pair<Key, Value>> res;
+    res.reserve(count);
+
+    if (!peel(
+            std::pmr::new_delete_resource(),
+            [&](const Bucket &bucket) {
+              res.push_back({bucket.cumulative_key, bucket.cumulative_value});
+            },
+            estimate.load + estimate.error))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Converts this InvertibleBloomDictionary into an immutable, more compact
+   * form that only answers contains() and get(), see FrozenDictionary
+   */
+  FrozenDictionary<InvertibleBloomDictionary> freeze() const {
+    return FrozenDictionary<InvertibleBloomDictionary>(*this);
+  }
+};
+
+/**
+ * Immutable form of an InvertibleBloomDictionary for dictionaries that are
+ * only queried once built. Construction peels the dictionary once and stores
+ * every recovered key with its exact value at one of its buckets that was
+ * pure while peeling, preferring earlier probes. Peeling empties such buckets
+ * for good, hence no two keys share one, and no unrecovered key touches one.
+ *
+ * Counts are dropped: per 64 buckets, one bitmap marks buckets holding a
+ * recovered key, another those left ambiguous by peeling, and a rank locates
+ * a bucket's key and value in dense arrays (SoA) of the recovered keys only.
+ * Empty and ambiguous buckets hence take 3 bits each instead of a whole
+ * bucket. Lookups stop at the first probe holding key, and answer exists or
+ * not_found exactly unless they hit an ambiguous bucket
+ */
+template <class Key, class Value, class HashFn, size_t K, class BucketCounter,
+          class DegreePolicy, class ValueCombiner, class KeyWidth>
+class FrozenDictionary<
+    InvertibleBloomDictionary<Key, Value, HashFn, K, BucketCounter,
+                              DegreePolicy, ValueCombiner, KeyWidth>> {
+  using Dictionary = InvertibleBloomDictionary<Key, Value, HashFn, K,
+                                               BucketCounter, DegreePolicy,
+                                               ValueCombiner, KeyWidth>;
+
+  static constexpr size_t absent = std::numeric_limits<size_t>::max();
+
+  struct Block {
+    // buckets holding a recovered key
+    std::uint64_t exact = 0;
+    // buckets holding keys peeling could not recover
+    std::uint64_t ambiguous = 0;
+    // recovered keys held by preceding blocks
+    std::uint64_t rank = 0;
+  };
+
+  HashFn hasher;
+
+  using Seed = std::uint64_t;
+  std::array<Seed, K> seeds;
+
+  size_t bucket_count;
+  size_t count;
+  std::vector<Block> blocks;
+  std::vector<Key> keys;
+  std::vector<Value> values;
+
+  std::uint64_t hash(const Key &key) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return hasher(key, seeds[0]);
+    else
+      return hasher(key);
+  }
+
+  /**
+   * Bucket index of key's i-th probe given its hash(), which seeded hash
+   * functions computed under the first probe's seed already
+   */
+  size_t hash_index(const Key &key, std::uint64_t hash, size_t i) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return detail::reduce(i == 0 ? hash : hasher(key, seeds[i]),
+                            bucket_count);
+    else
+      return detail::reduce(detail::mix(hash ^ seeds[i]), bucket_count);
+  }
+
+  /**
+   * Position of key within keys and values, or absent. Sets might_exist
+   * if any probed bucket is ambiguous
+   */
+  size_t find(const Key &key, bool &might_exist) const {
+    const auto hash = this->hash(key);
+
+    const auto degree = DegreePolicy::template degree<K>(hash);
+    for (size_t i = 0; i < degree; i++) {
+      const auto index = hash_index(key, hash, i);
+      const auto &block = blocks[index / 64];
+      const auto bit = std::uint64_t(1) << (index % 64);
+
+      if (block.exact & bit) {
+        const auto position =
+            block.rank + std::popcount(block.exact & (bit - 1));
+        if (keys[position] == key)
+          return position;
+      }
+      might_exist |= (block.ambiguous & bit) != 0;
+    }
+    return absent;
+  }
+
+public:
+  using key_type = Key;
+
+  explicit FrozenDictionary(const Dictionary &dictionary)
+      : hasher(dictionary.hasher), seeds(dictionary.seeds),
+        bucket_count(dictionary.buckets.size()), count(dictionary.count),
+        blocks((bucket_count + 63) / 64) {
+    detail::Scratch<typename Dictionary::Bucket> scratch(
+        dictionary.buckets, std::pmr::get_default_resource());
+
+    // (bucket index, key, value) of every recovered key, at the first probe
+    // that is pure when the key peels
+    std::vector<std::tuple<size_t, Key, Value>> recovered;
+    recovered.reserve(count);
+    dictionary.peel(
+        scratch,
+        [&](const auto &bucket) {
+          for (const auto index :
+               dictionary.hash_indices(bucket.cumulative_key)) {
+            const auto *pure = scratch.find(index);
+            if (pure != nullptr && pure->count == 1 &&
+                pure->cumulative_key == bucket.cumulative_key) {
+              recovered.emplace_back(index, bucket.cumulative_key,
+                                     bucket.cumulative_value);
+              return;
+            }
+          }
+        },
+        std::nullopt);
+    std::sort(recovered.begin(), recovered.end(),
+              [](const auto &a, const auto &b) {
+                return std::get<0>(a) < std::get<0>(b);
+              });
+
+    keys.reserve(recovered.size());
+    values.reserve(recovered.size());
+    for (const auto &[index, key, value] : recovered) {
+      blocks[index / 64].exact |= std::uint64_t(1) << (index % 64);
+      keys.push_back(key);
+      values.push_back(value);
+    }
+    for (size_t position = 0; position < scratch.size(); position++) {
+      if (scratch[position].count == 0)
+        continue;
+      const auto index = scratch.index(position);
+      blocks[index / 64].ambiguous |= std::uint64_t(1) << (index % 64);
+    }
+
+    std::uint64_t rank = 0;
+    for (auto &block : blocks) {
+      block.rank = rank;
+      rank += std::popcount(block.exact);
+    }
+  }
+
+  /**
+   * Count of keys in the frozen InvertibleBloomDictionary
+   */
+  size_t size() const { return count; }
+
+  /**
+   * Count of keys recovered on construction, i.e., whose lookups are exact
+   */
+  size_t recovered() const { return keys.size(); }
+
+  size_t directory_size() const { return bucket_count; }
+
+  /**
+   * Bytes taken by bitmaps, keys and values
+   */
+  size_t byte_size() const {
+    return blocks.size() * sizeof(Block) + keys.size() * sizeof(Key) +
+           values.size() * sizeof(Value);
+  }
+
+  /**
+   * Checks whether a key is contained. Only returns might_exist for keys that
+   * were not recovered on construction
+   */
+  ContainsResult contains(const Key &key) const {
+    bool might_exist = false;
+    if (find(key, might_exist) != absent)
+      return ContainsResult::exists;
+    return might_exist ? ContainsResult::might_exist
+                       : ContainsResult::not_found;
+  }
+
+  /**
+   * Returns the value associated with key if it was recovered on construction
+   */
+  std::optional<Value> get(const Key &key) const {
+    bool might_exist = false;
+    const auto position = find(key, might_exist);
+    if (position == absent)
+      return std::nullopt;
+    return values[position];
+  }
+};
 
 /**
- * InvertibleBloomFilter is a probabilistic set data structure.
+ * SpatiallyCoupledInvertibleBloomFilter is an InvertibleBloomFilter variant
+ * whose directory is split into a chain of equally sized windows. Each key
+ * picks a random start window and hashes to one bucket in each of the K
+ * consecutive windows from there on.
  *
- * It can do everything a normal bloom filter is capable of probabilistically
- * recovering the original keyset
+ * Keys near either end of the chain have fewer competitors for their buckets
+ * and hence peel easily. Peeling them frees up buckets further inward, i.e.,
+ * decoding proceeds like a wave along the chain. This allows peeling at higher
+ * loads than an uncoupled filter (about 1.14 instead of 1.23 buckets per key
+ * for K = 3 and a million keys, see the coupled_threshold benchmark).
+ *
+ * The sparsely populated chain ends waste about K / windows of the directory,
+ * hence windows should not be too few. Too many (small) windows on the other
+ * hand make it likely that keys within a window end up sharing all their
+ * buckets, which no peeling can resolve. Roughly 100 windows work well for
+ * 10^5 to 10^7 keys
  */
 template <class Key, class HashFn, size_t K = 3,
           class BucketCounter = std::uint16_t>
-class InvertibleBloomFilter {
+class SpatiallyCoupledInvertibleBloomFilter {
   struct Bucket {
     Key cumulative_key = 0;
     BucketCounter count = 0;
   } /*__attribute((packed))*/;
 
-  const HashFn hasher;
+  HashFn hasher{};
 
   using Seed = std::uint64_t;
-  std::array<Seed, K> seeds;
+  // one seed per probe plus one for the start window
+  std::array<Seed, K + 1> seeds;
 
-  std::vector<Bucket> buckets;
+  size_t window_size;
+  size_t windows;
+  detail::PagedDirectory<Bucket> buckets;
   size_t count;
 
-  size_t hash_index(const Key &key, const Seed &seed) const {
-    const auto hash = (hasher(key) ^ seed);
-    return hash % buckets.size(); // TODO: use fast modulo
+  // hash of key under seed, see SeededHashFn
+  std::uint64_t seeded_hash(const Key &key, const Seed &seed) const {
+    if constexpr (SeededHashFn<HashFn, Key>)
+      return hasher(key, seed);
+    else
+      // start window and in-window offsets must not share hash bits, hence
+      // unseeded hashes are remixed instead of only xor-ed with a seed
+      return detail::mix(hasher(key) ^ seed);
+  }
+
+  std::array<size_t, K> hash_indices(const Key &key) const {
+    const auto start =
+        detail::reduce(seeded_hash(key, seeds[K]), windows - K + 1);
+
+    // probes land in distinct windows, hence never collide
+    std::array<size_t, K> indices;
+    detail::unroll<K>([&](auto i) {
+      indices[i] = (start + i) * window_size +
+                   detail::reduce(seeded_hash(key, seeds[i]), window_size);
+    });
+    return indices;
+  }
+
+  /**
+   * Peels along the chain: buckets are visited window by window, and buckets
+   * turned pure by peeling a key are peeled right away (depth first), which
+   * follows the decoding wave instead of rescanning the whole directory
+   */
+  template <class Emit>
+  bool peel(std::pmr::memory_resource *resource, Emit &&emit) const {
+    std::pmr::vector<Bucket> scratch(buckets.size(), resource);
+    buckets.copy_to(scratch.data());
+    std::pmr::vector<size_t> worklist(resource);
+
+    size_t recovered = 0;
+    const auto peel_bucket = [&](size_t i) {
+      const auto bucket = scratch[i];
+      if (bucket.count != 1)
+        return;
+
+      // key must hash to this bucket to be pure
+      const auto indices = hash_indices(bucket.cumulative_key);
+      if (std::find(indices.begin(), indices.end(), i) == indices.end())
+        return;
+
+      emit(bucket.cumulative_key);
+      recovered++;
+
+      detail::unroll<K>([&](auto j) {
+        auto &other = scratch[indices[j]];
+        other.cumulative_key ^= bucket.cumulative_key;
+        other.count--;
+        if (other.count == 1)
+          worklist.push_back(indices[j]);
+      });
+    };
+
+    for (size_t i = 0; i < scratch.size(); i++) {
+      peel_bucket(i);
+      while (!worklist.empty()) {
+        const auto next = worklist.back();
+        worklist.pop_back();
+        peel_bucket(next);
+      }
+    }
+
+    return recovered == count;
+  }
+
+  /**
+   * Buckets per window of a size buckets directory split into windows
+   * windows. Throws std::invalid_argument unless there are at least K
+   * windows of at least one bucket each
+   */
+  static size_t checked_window_size(size_t size, size_t windows) {
+    if (windows < K)
+      throw std::invalid_argument("need at least K windows");
+    if (size < windows)
+      throw std::invalid_argument("need at least one bucket per window");
+    return size / windows;
   }
 
 public:
+  using key_type = Key;
+
   /**
-   * Constructs and InvertibleBloomFilter given a target directory size and
-   * seed (defaults to std::random_device()()). Note that the directory never
-   * resizes during InvertibleBloomFilter's lifetime, hence you must pick a
-   * value that fits your keys upfront
+   * Constructs a SpatiallyCoupledInvertibleBloomFilter given a target
+   * directory size, the amount of windows to split it into (at least K, none
+   * of them empty) and seed (defaults to std::random_device()()). The
+   * directory size is rounded down to a multiple of windows. Note that the
+   * directory never resizes during SpatiallyCoupledInvertibleBloomFilter's
+   * lifetime, hence you must pick a value that fits your keys upfront
    */
-  InvertibleBloomFilter(size_t size, unsigned int seed = std::random_device()())
-      : buckets(size), count(0) {
-    std::default_random_engine rng(seed);
-    std::uniform_int_distribution<Seed> dist(std::numeric_limits<Seed>::min(),
-                                             std::numeric_limits<Seed>::max());
+  SpatiallyCoupledInvertibleBloomFilter(
+      size_t size, size_t windows, unsigned int seed = std::random_device()())
+      : window_size(checked_window_size(size, windows)), windows(windows),
+        buckets(window_size * windows), count(0) {
+    seeds = detail::generate_seeds<Seed, K + 1>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Count of keys in this SpatiallyCoupledInvertibleBloomFilter
+   */
+  size_t size() const { return count; }
+
+  /**
+   * Size of internal bucket directory
+   */
+  size_t directory_size() const { return buckets.size(); }
+
+  /**
+   * Amount of windows the directory is split into
+   */
+  size_t window_count() const { return windows; }
+
+  /**
+   * Exposes internally used seeds, useful for testing or external serialization
+   */
+  std::array<Seed, K + 1> listSeeds() const { return seeds; }
+
+  /**
+   * Removes all keys from this SpatiallyCoupledInvertibleBloomFilter without
+   * reallocating its directory
+   */
+  void clear() {
+    buckets.clear();
+    count = 0;
+  }
+
+  /**
+   * Removes all keys and reseeds this SpatiallyCoupledInvertibleBloomFilter in
+   * place, without allocating or querying std::random_device
+   */
+  void reset(unsigned int seed) {
+    clear();
+    seeds = detail::generate_seeds<Seed, K + 1>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
+
+  /**
+   * Inserts a single key
+   */
+  void insert(const Key &key) {
+    const auto indices = hash_indices(key);
+    detail::unroll<K>([&](auto i) {
+      auto &bucket = buckets.mutate(indices[i]);
+      bucket.cumulative_key ^= key;
+      bucket.count++;
+    });
+
+    count += 1;
+  }
+
+  /**
+   * Checks whether a key is contained in this filter. May return false
+   * positives, but never false negatives
+   */
+  ContainsResult contains(const Key &key) const {
+    bool might_exist = false;
+    for (const auto &index : hash_indices(key)) {
+      const auto &bucket = buckets[index];
+      if (bucket.count == 1)
+        return key == bucket.cumulative_key ? ContainsResult::exists
+                                            : ContainsResult::not_found;
+
+      might_exist |= bucket.count > 1;
+    }
+
+    return might_exist ? ContainsResult::might_exist
+                       : ContainsResult::not_found;
+  }
+
+  /**
+   * Removes a single key. Note that it is possible for this operation to fail
+   * (return false) not because the key doesn't exist, but because it is not
+   * uniquely identifyable
+   */
+  bool remove(const Key &key) {
+    const auto indices = hash_indices(key);
+    if (detail::probe(buckets, indices, key).contains() !=
+        ContainsResult::exists)
+      return false;
+
+    detail::unroll<K>([&](auto i) {
+      auto &bucket = buckets.mutate(indices[i]);
+      assert(bucket.count > 0);
+
+      bucket.cumulative_key ^= key;
+      bucket.count--;
+    });
+
+    count -= 1;
+    return true;
+  }
+
+  /**
+   * Attempts to retrieve all keys. This operation might fail due to the
+   * probabilistic nature of this struct
+   */
+  std::optional<std::unordered_set<Key>> listAll() const {
+    std::unordered_set<Key> res;
+    res.reserve(count);
+
+    if (!peel(std::pmr::new_delete_resource(),
+              [&](const Key &key) { res.insert(key); }))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+
+  /**
+   * Like listAll(), except that all decoding scratch memory as well as the
+   * result are allocated from resource
+   */
+  std::optional<std::pmr::unordered_set<Key>>
+  listAll(std::pmr::memory_resource *resource) const {
+    std::pmr::unordered_set<Key> res(resource);
+    res.reserve(count);
+
+    if (!peel(resource, [&](const Key &key) { res.insert(key); }))
+      return std::nullopt;
+
+    return std::make_optional(std::move(res));
+  }
+};
+
+/**
+ * Per filter ContainsResult of a FilterGroup query. Results are stored as two
+ * bitmaps (exists, might_exist), i.e., a filter whose bit is unset in both
+ * reported not_found
+ */
+class ContainsBitmap {
+  std::vector<std::uint64_t> exists_bits;
+  std::vector<std::uint64_t> might_exist_bits;
+  size_t count = 0;
+
+public:
+  /**
+   * Resets all results to not_found, sized for the given amount of filters
+   */
+  void reset(size_t filters) {
+    count = filters;
+    exists_bits.assign((filters + 63) / 64, 0);
+    might_exist_bits.assign((filters + 63) / 64, 0);
+  }
+
+  void set(size_t i, ContainsResult result) {
+    exists_bits[i / 64] |= std::uint64_t(result == ContainsResult::exists)
+                           << (i % 64);
+    might_exist_bits[i / 64] |=
+        std::uint64_t(result == ContainsResult::might_exist) << (i % 64);
+  }
+
+  ContainsResult operator[](size_t i) const {
+    if ((exists_bits[i / 64] >> (i % 64)) & 1)
+      return ContainsResult::exists;
+    if ((might_exist_bits[i / 64] >> (i % 64)) & 1)
+      return ContainsResult::might_exist;
+    return ContainsResult::not_found;
+  }
+
+  /**
+   * Amount of filters this bitmap holds results for
+   */
+  size_t size() const { return count; }
+
+  /**
+   * Raw bitmap words, bit i is set iff filter i reported exists
+   */
+  const std::vector<std::uint64_t> &exists() const { return exists_bits; }
+
+  /**
+   * Raw bitmap words, bit i is set iff filter i reported might_exist
+   */
+  const std::vector<std::uint64_t> &might_exist() const {
+    return might_exist_bits;
+  }
+};
+
+/**
+ * FilterGroup answers contains() for a single key across many filters (e.g.,
+ * one filter per partition or day) at once. All filters in a group must share
+ * directory size, seeds and, for keyed hash functions such as SipHash13, the
+ * hash function's state, i.e., be constructed with the same size, seed and
+ * hasher.
+ * This way the key is hashed only once, after which every filter's buckets are
+ * probed with software prefetching to overlap cache misses.
+ *
+ * The group only references its filters, which must therefore outlive it
+ */
+template <class Filter> class FilterGroup {
+  using Key = typename Filter::key_type;
+
+  // how many filters ahead of the current one to prefetch
+  static constexpr size_t prefetch_distance = 4;
 
-    for (size_t i = 0; i < K; i++) {
-      // generate until we find a new random seed
-      Seed rand_seed = 0;
-      bool already_exists = false;
-      do {
-        rand_seed = dist(rng);
-        for (size_t j = 0; j < i; j++)
-          already_exists |= seeds[j] == rand_seed;
-      } while (already_exists);
+  std::vector<const Filter *> filters;
+
+public:
+  /**
+   * Adds a filter to this group. Returns false and does not add the filter if
+   * its directory size, seeds or (equality comparable) hasher differ from the
+   * filters already in the group
+   */
+  bool add(const Filter &filter) {
+    if (!filters.empty()) {
+      const auto &first = *filters.front();
+      if (first.directory_size() != filter.directory_size() ||
+          first.listSeeds() != filter.listSeeds())
+        return false;
+      if constexpr (std::equality_comparable<decltype(first.hasher)>)
+        if (first.hasher != filter.hasher)
+          return false;
+    }
+
+    filters.push_back(&filter);
+    return true;
+  }
+
+  /**
+   * Amount of filters in this group
+   */
+  size_t size() const { return filters.size(); }
+
+  /**
+   * Checks whether key is contained in each filter of this group. Result i
+   * corresponds to the i-th added filter
+   */
+  void contains(const Key &key, ContainsBitmap &result) const {
+    result.reset(filters.size());
+    if (filters.empty() || filters.front()->directory_size() == 0)
+      return;
+
+    const auto indices = filters.front()->hash_indices(key);
+
+    const auto prefetched = std::min(prefetch_distance, filters.size());
+    for (size_t i = 0; i < prefetched; i++)
+      filters[i]->prefetch(indices);
+
+    for (size_t i = 0; i < filters.size(); i++) {
+      if (i + prefetch_distance < filters.size())
+        filters[i + prefetch_distance]->prefetch(indices);
+
+      result.set(i, filters[i]->contains(key, indices));
+    }
+  }
+
+  /**
+   * Checks whether key is contained in each filter of this group. Result i
+   * corresponds to the i-th added filter
+   */
+  ContainsBitmap contains(const Key &key) const {
+    ContainsBitmap result;
+    contains(key, result);
+    return result;
+  }
+};
+/**
+ * TwoTierFilter puts two small front InvertibleBloomFilters, sized to stay
+ * cache resident, in front of a large back filter. Inserts go to the young
+ * front generation. Every max_age updates, the old generation's keys move to
+ * the back filter in one bucket ordered batch, and the young generation
+ * becomes the old one. Keys hence move to the back filter only once they
+ * survived at least max_age updates, and keys removed before that never touch
+ * the back filter's directory.
+ *
+ * Each front generation logs the keys inserted into and removed from it. Keys
+ * an old generation fails to peel form a 2-core, which the logged keys solve
+ * for, see InvertibleBloomFilter::listAll(candidates). Only generations too
+ * overloaded for that move to a third front filter of stalled keys, along
+ * with their logs. Every update retries decoding the stalled filter once it
+ * changed, e.g., by removals, moving whatever decodes to the back filter. The
+ * young generation hence always starts out empty.
+ *
+ * remove() consults the logs of front tiers that might hold a key, so keys
+ * inserted and removed again within the front cancel there, even without a
+ * pure bucket, and never touch the back filter. Like InvertibleBloomFilter,
+ * each key may only be inserted once at a time.
+ *
+ * All tiers share their seed and copies of one hasher, queries consult all of
+ * them. Only defined for InvertibleBloomFilter, whose decoder the tiers use
+ * directly
+ */
+template <class Key, class HashFn, size_t K, class BucketCounter,
+          class DegreePolicy, class KeyWidth>
+class TwoTierFilter<InvertibleBloomFilter<Key, HashFn, K, BucketCounter,
+                                          DegreePolicy, KeyWidth>> {
+  using Filter = InvertibleBloomFilter<Key, HashFn, K, BucketCounter,
+                                       DegreePolicy, KeyWidth>;
+
+  /**
+   * Keys inserted into and removed from a front tier, in order
+   */
+  struct Log {
+    std::vector<Key> inserted, removed;
+
+    /**
+     * Whether key was inserted more often than removed, i.e., is held
+     */
+    bool holds(const Key &key) const {
+      return std::count(inserted.begin(), inserted.end(), key) >
+             std::count(removed.begin(), removed.end(), key);
+    }
+
+    /**
+     * Keys held, i.e., inserted more often than removed
+     */
+    std::vector<Key> held() const {
+      auto in = inserted, out = removed;
+      std::sort(in.begin(), in.end());
+      std::sort(out.begin(), out.end());
+      std::vector<Key> res;
+      std::set_difference(in.begin(), in.end(), out.begin(), out.end(),
+                          std::back_inserter(res));
+      return res;
+    }
+
+    void append(const Log &other) {
+      inserted.insert(inserted.end(), other.inserted.begin(),
+                      other.inserted.end());
+      removed.insert(removed.end(), other.removed.begin(),
+                     other.removed.end());
+    }
+
+    void clear() {
+      inserted.clear();
+      removed.clear();
+    }
+  };
+
+  Filter young, old, stalled, back;
+  Log young_log, old_log, stalled_log;
+  size_t max_age;
+  // updates since the last generation change
+  size_t age = 0;
+  // whether stalled changed since decoding it was last attempted
+  bool stalled_changed = false;
+
+  /**
+   * Adds all keys of from to into, bucket by bucket. Both must share their
+   * directory size and seed
+   */
+  static void merge(Filter &into, const Filter &from) {
+    for (size_t i = 0; i < from.buckets.size(); i++) {
+      const auto &bucket = from.buckets[i];
+      if (bucket.count == 0)
+        continue;
+
+      auto &merged = into.buckets.mutate(i);
+      merged.cumulative_key ^= Key(bucket.cumulative_key);
+      merged.count += bucket.count;
+    }
+    into.count += from.count;
+  }
+
+  /**
+   * Decodes front by peeling, solving what peeling leaves among the keys log
+   * holds. Moves all decoded keys to the back filter and returns whether
+   * front decoded completely, in which case it is left empty
+   */
+  bool drain(Filter &front, Log &log) {
+    std::vector<Key> keys;
+    detail::Scratch<typename Filter::Bucket> scratch(
+        front.buckets, std::pmr::get_default_resource());
+    const auto decoded =
+        front.peel(
+            scratch,
+            [&](const auto &bucket) { keys.push_back(bucket.cumulative_key); },
+            std::nullopt) ||
+        [&] {
+          const auto candidates = log.held();
+          return front.solve(scratch, candidates.data(), candidates.size(),
+                             [&](const Key &key) { keys.push_back(key); });
+        }();
+
+    back.insert_ordered(keys.data(), keys.size(),
+                        std::pmr::get_default_resource());
+    if (decoded) {
+      front.clear();
+      log.clear();
+      return true;
+    }
+
+    for (const auto &key : keys) {
+      front.erase(key, front.hash_indices(key));
+      log.removed.push_back(key);
+    }
+    return false;
+  }
+
+  /**
+   * Moves all decodable keys of the old generation to the back filter and
+   * the undecodable ones to the stalled filter, leaving the old generation
+   * empty
+   */
+  void flush_old() {
+    if (!drain(old, old_log)) {
+      merge(stalled, old);
+      stalled_log.append(old_log);
+      stalled_changed = true;
+      old.clear();
+      old_log.clear();
+    }
+  }
+
+  /**
+   * Retries decoding the stalled filter if it changed since the last attempt
+   */
+  void retry_stalled() {
+    if (stalled_changed)
+      drain(stalled, stalled_log);
+    stalled_changed = false;
+  }
 
-      seeds[i] = rand_seed;
+  void update() {
+    if (++age >= max_age) {
+      flush_old();
+      std::swap(young, old);
+      std::swap(young_log, old_log);
+      age = 0;
     }
+    retry_stalled();
   }
 
+public:
   /**
-   * Count of keys in this InvertibleBloomFilter
+   * Constructs a TwoTierFilter whose back filter has size buckets and whose
+   * front filters have front_size buckets each. Keys move to the back filter
+   * after surviving max_age to 2 * max_age updates
    */
-  size_t size() const { return count; }
+  TwoTierFilter(size_t size, size_t front_size, size_t max_age,
+                unsigned int seed = std::random_device()())
+      : TwoTierFilter(size, front_size, max_age, HashFn(), seed) {}
 
   /**
-   * Size of internal bucket directory
+   * Constructs a TwoTierFilter whose tiers hash with copies of hasher, e.g., a
+   * SipHash13 keyed with a secret
    */
-  size_t directory_size() const { return buckets.size(); }
+  TwoTierFilter(size_t size, size_t front_size, size_t max_age,
+                const HashFn &hasher,
+                unsigned int seed = std::random_device()())
+      : young(front_size, hasher, seed), old(front_size, hasher, seed),
+        stalled(front_size, hasher, seed), back(size, hasher, seed),
+        max_age(max_age) {
+    assert(max_age > 0);
+  }
 
   /**
-   * Exposes internally used seeds, useful for testing or external serialization
+   * Count of keys across all tiers
    */
-  std::array<Seed, K> listSeeds() const { return seeds; }
+  size_t size() const {
+    return young.size() + old.size() + stalled.size() + back.size();
+  }
+
+  const Filter &back_tier() const { return back; }
 
   /**
-   * Inserts a single key with its corresponding value
+   * Count of keys the front generations failed to decode so far
    */
-  void insert(const Key &key) {
-    // keep track of indices we already set to avoid issues with two hashes
-    // going to same bucket
-    std::unordered_set<size_t> seen_indices;
+  size_t stalled_size() const { return stalled.size(); }
 
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
+  void insert(const Key &key) {
+    young.insert(key);
+    young_log.inserted.push_back(key);
+    update();
+  }
 
-      // fix issue with hashfn hashing to same slot
-      if (seen_indices.find(index) != seen_indices.end())
+  /**
+   * Removes key from the youngest tier holding it. Front tiers identify it by
+   * a pure bucket or else by their logs, the back filter only by a pure
+   * bucket, hence like InvertibleBloomFilter::remove() this may fail for keys
+   * in the back filter even if they exist
+   */
+  bool remove(const Key &key) {
+    const std::array<std::pair<Filter *, Log *>, 3> fronts{
+        {{&young, &young_log}, {&old, &old_log}, {&stalled, &stalled_log}}};
+    for (const auto &[front, log] : fronts) {
+      const auto indices = front->hash_indices(key);
+      const auto masks = detail::probe(front->buckets, indices, key);
+      if (masks.contains() == ContainsResult::not_found)
+        continue;
+      if (masks.contains() != ContainsResult::exists && !log->holds(key))
         continue;
-      seen_indices.insert(index);
 
-      auto &bucket = buckets[index];
-      bucket.cumulative_key ^= key;
-      bucket.count++;
+      front->erase(key, indices);
+      log->removed.push_back(key);
+      stalled_changed |= front == &stalled;
+      update();
+      return true;
     }
 
-    count += 1;
+    if (!back.remove(key))
+      return false;
+    update();
+    return true;
   }
 
-  /**
-   * Checks whether a key is contained in this IBF. May return false positives,
-   * but never false negatives
-   */
   ContainsResult contains(const Key &key) const {
-    bool might_exist = false;
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
+    auto front = std::max(young.contains(key), old.contains(key));
+    front = std::max(front, stalled.contains(key));
+    if (front == ContainsResult::exists)
+      return front;
+    return std::max(front, back.contains(key));
+  }
 
-      const auto &bucket = buckets[index];
-      if (bucket.count == 1)
-        return key == bucket.cumulative_key ? ContainsResult::exists
-                                            : ContainsResult::not_found;
+  /**
+   * Moves all decodable keys of both front generations to the back filter
+   */
+  void flush() {
+    flush_old();
+    std::swap(young, old);
+    std::swap(young_log, old_log);
+    flush_old();
+    age = 0;
+    retry_stalled();
+  }
 
-      might_exist |= bucket.count > 1;
+  /**
+   * Attempts to retrieve all keys across all tiers, solving for the front
+   * tiers' leftovers among their logged keys
+   */
+  std::optional<std::unordered_set<Key>> listAll() const {
+    auto res = back.listAll();
+    if (!res)
+      return std::nullopt;
+    const std::array<std::pair<const Filter *, const Log *>, 3> fronts{
+        {{&stalled, &stalled_log}, {&old, &old_log}, {&young, &young_log}}};
+    for (const auto &[front, log] : fronts) {
+      const auto candidates = log->held();
+      auto keys = front->listAll(candidates.data(), candidates.size());
+      if (!keys)
+        return std::nullopt;
+      res->merge(*keys);
     }
-
-    return might_exist ? ContainsResult::might_exist
-                       : ContainsResult::not_found;
+    return res;
   }
+};
+/**
+ * StashedFilter keeps an InvertibleBloomFilter (Filter) decodable by moving
+ * keys that would end up in its unpeelable 2-core to a small exact stash. Keys
+ * inserted since the last maintenance pass are remembered as pending.
+ * maintain() peels the filter and stashes every pending key peeling leaves
+ * behind. The filter's other keys peeled before, and any subset of a peelable
+ * key set peels as well, hence listAll() never fails. Allows running the
+ * directory near its peeling threshold.
+ *
+ * Maintenance runs automatically once max_pending keys are pending. listAll()
+ * handles pending keys alike without stashing them
+ */
+template <class Filter> class StashedFilter {
+  using Key = typename Filter::key_type;
+
+  Filter filter;
+  std::unordered_set<Key> stash;
+  std::unordered_set<Key> pending;
+  size_t max_pending;
 
   /**
-   * Removes a single key and its corresponding value from
-   * the struct. Note that it is possible for this operation
-   * to fail (return false) not because the key doesn't exist,
-   * but because it is not uniquely identifyable
+   * Peels the filter, calling emit for every recovered key. Once peeling
+   * stalls, pending keys left behind are emitted, subtracted from the residual
+   * and passed to stashed, after which peeling resumes. Returns false only if
+   * keys remain nonetheless, i.e., if the filter was corrupted, e.g., by
+   * erasing keys it does not contain
    */
-  bool remove(Key key) {
-    if (contains(key) != ContainsResult::exists)
-      return false;
-
-    // keep track of indices we already set to avoid issues with two hashes
-    // going to same bucket
-    std::unordered_set<size_t> seen_indices;
+  template <class Emit, class Stashed>
+  bool peel(Emit &&emit, Stashed &&stashed) const {
+    detail::Scratch<typename Filter::Bucket> scratch(
+        filter.buckets, std::pmr::get_default_resource());
 
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
+    size_t recovered = 0;
+    std::unordered_set<Key> peeled_pending;
+    const auto recover = [&](const auto &bucket) {
+      if (pending.contains(bucket.cumulative_key))
+        peeled_pending.insert(bucket.cumulative_key);
+      emit(bucket.cumulative_key);
+      recovered++;
+    };
+    if (filter.peel(scratch, recover, std::nullopt))
+      return true;
 
-      // fix issue with hashfn hashing to same slot
-      if (seen_indices.find(index) != seen_indices.end())
+    for (const auto &key : pending) {
+      if (peeled_pending.contains(key))
         continue;
-      seen_indices.insert(index);
 
-      auto &bucket = buckets[index];
-      assert(bucket.count > 0);
+      const auto indices = filter.hash_indices(key);
+      const auto duplicates = detail::duplicate_probes(indices);
+      for (size_t j = 0; j < indices.size(); j++) {
+        if ((duplicates >> j) & 1)
+          continue;
 
-      bucket.cumulative_key ^= key;
-      bucket.count--;
+        auto *bucket = scratch.find(indices[j]);
+        if (bucket == nullptr || bucket->count == 0)
+          return false;
+        bucket->cumulative_key ^= key;
+        bucket->count--;
+      }
+      emit(key);
+      stashed(key);
+      recovered++;
     }
 
-    count -= 1;
-    return true;
+    filter.peel(scratch, recover, std::nullopt);
+    return recovered == filter.size();
   }
 
+public:
   /**
-   * Attempts to retrieve all key, value pairs. This operation might fail
-   * due to the probabilistic nature of this struct
+   * Constructs a StashedFilter whose filter has size buckets. Maintenance
+   * peels the whole directory once max_pending keys are pending, hence
+   * max_pending trades memory for maintenance cost per insert
    */
-  std::optional<std::unordered_set<Key>> listAll() const {
-    std::unordered_set<Key> res;
-    res.reserve(count);
+  StashedFilter(size_t size, size_t max_pending,
+                unsigned int seed = std::random_device()())
+      : filter(size, seed), max_pending(max_pending) {
+    assert(max_pending > 0);
+  }
 
-    auto copy = *this;
+  /**
+   * Count of keys in the filter and stash
+   */
+  size_t size() const { return filter.size() + stash.size(); }
 
-    // TODO: come up with faster algorithm
-    bool finished = false;
-    bool has_changed = true;
-    while (!finished && has_changed) {
-      finished = true;
-      has_changed = false;
-      for (size_t i = 0; i < copy.buckets.size(); i++) {
-        const auto &bucket = copy.buckets[i];
+  /**
+   * Count of keys in the stash
+   */
+  size_t stash_size() const { return stash.size(); }
 
-        // skip already empty buckets
-        if (bucket.count == 0)
-          continue;
+  const Filter &filter_tier() const { return filter; }
 
-        // skip ambiguous buckets
-        if (bucket.count > 1) {
-          finished = false;
-          continue;
-        }
+  void insert(const Key &key) {
+    filter.insert(key);
+    pending.insert(key);
+    if (pending.size() >= max_pending)
+      maintain();
+  }
 
-        res.insert(bucket.cumulative_key);
-        has_changed = copy.remove(bucket.cumulative_key);
+  /**
+   * Inserts n keys, hashing and prefetching their buckets in batches
+   */
+  void insert(const Key *keys, size_t n) {
+    filter.insert(keys, n);
+    pending.insert(keys, keys + n);
+    if (pending.size() >= max_pending)
+      maintain();
+  }
 
-        assert(bucket.count == 0);
-      }
+  /**
+   * Removes key from the stash, or else from the filter. Like
+   * InvertibleBloomFilter::remove() the latter may fail even if key exists
+   */
+  bool remove(const Key &key) {
+    if (stash.erase(key) != 0)
+      return true;
+    if (!filter.remove(key))
+      return false;
+    pending.erase(key);
+    return true;
+  }
+
+  /**
+   * Removes a key known to be contained without verifying that it is, see
+   * InvertibleBloomFilter::erase()
+   */
+  void erase(const Key &key) {
+    if (stash.erase(key) != 0)
+      return;
+    filter.erase(key);
+    pending.erase(key);
+  }
+
+  ContainsResult contains(const Key &key) const {
+    if (stash.contains(key))
+      return ContainsResult::exists;
+    return filter.contains(key);
+  }
+
+  /**
+   * Moves pending keys that peeling leaves behind from the filter to the
+   * stash. Costs one peel of the directory
+   */
+  void maintain() {
+    std::vector<Key> core;
+    peel([](const Key &) {}, [&](const Key &key) { core.push_back(key); });
+
+    for (const auto &key : core) {
+      filter.erase(key);
+      stash.insert(key);
     }
+    pending.clear();
+  }
+
+  /**
+   * Retrieves all keys across filter and stash. Only fails if the filter was
+   * corrupted, e.g., by erasing keys it does not contain
+   */
+  std::optional<std::unordered_set<Key>> listAll() const {
+    std::unordered_set<Key> res(stash);
+    res.reserve(size());
 
-    if (!finished || res.size() != count)
+    if (!peel([&](const Key &key) { res.insert(key); }, [](const Key &) {}))
       return std::nullopt;
 
-    return std::make_optional(res);
+    return std::make_optional(std::move(res));
   }
 };
-
 /**
- * InvertibleBloomDictionary is a probabilistic dictionary data structure.
+ * FlowEncoder sums up values, e.g., packet sizes, per flow over a stream of
+ * (flow key, value) records, in the spirit of FlowRadar. A Bloom filter of
+ * all flows seen so far (the flow set) recognizes a record's flow as new, in
+ * which case the flow is inserted into an additive InvertibleBloomDictionary.
+ * Records of known flows only accumulate their value. Each flow hence enters
+ * the key sums exactly once, and decoding a snapshot yields every flow's total.
  *
- * It can do everything a normal bloom filter is capable of and, with a certain
- * probability < 1, recover associated values and also the original keyset
+ * Flow set false positives make new flows look known. accumulate() still
+ * inserts such flows if their buckets prove them absent, which is likely
+ * unless the dictionary is heavily loaded. Otherwise their values silently add
+ * to other flows' totals. Hence size the flow set generously, e.g., 16 bits
+ * per flow
  */
 template <class Key, class Value, class HashFn, size_t K = 3,
           class BucketCounter = std::uint16_t>
-class InvertibleBloomDictionary {
-  struct Bucket {
-    Key cumulative_key = 0;
-    Value cumulative_value = 0;
-    BucketCounter count = 0;
-  } /*__attribute((packed))*/;
-
-  const HashFn hasher;
+class FlowEncoder {
+public:
+  using Dictionary = InvertibleBloomDictionary<Key, Value, HashFn, K,
+                                               BucketCounter, RegularDegree,
+                                               AdditiveCombiner>;
 
-  using Seed = std::uint64_t;
-  std::array<Seed, K> seeds;
+private:
+  // records hashed and prefetched at once
+  static constexpr size_t batch_size = Dictionary::batch_size;
 
-  std::vector<Bucket> buckets;
-  size_t count;
+  Dictionary dictionary;
+  // dictionaries of later epochs are constructed alike
+  HashFn hasher;
+  unsigned int seed;
+  std::vector<std::uint64_t> flow_set;
+  size_t flow_set_bits;
+  std::array<std::uint64_t, K> flow_set_seeds;
+  // snapshots taken so far, each epoch's flow set is seeded differently
+  unsigned int epoch = 0;
 
-  size_t hash_index(const Key &key, const Seed &seed) const {
-    const auto hash = (hasher(key) ^ seed);
-    return hash % buckets.size(); // TODO: use fast modulo
+  /**
+   * Flow set bits of a key given its dictionary hash
+   */
+  std::array<size_t, K> flow_set_indices(std::uint64_t hash) const {
+    std::array<size_t, K> indices;
+    detail::unroll<K>([&](auto i) {
+      indices[i] = detail::reduce(detail::mix(hash ^ flow_set_seeds[i]),
+                                  flow_set_bits);
+    });
+    return indices;
   }
 
-public:
   /**
-   * Constructs and InvertibleBloomDictionary given a target directory size and
-   * seed (defaults to std::random_device()()). Note that the directory never
-   * resizes during InvertibleBloomDictionary's lifetime, hence you must pick a
-   * value that fits your keys upfront
+   * Adds a flow to the flow set, returning whether it was new
    */
-  InvertibleBloomDictionary(size_t size,
-                            unsigned int seed = std::random_device()())
-      : buckets(size), count(0) {
-    std::default_random_engine rng(seed);
-    std::uniform_int_distribution<Seed> dist(std::numeric_limits<Seed>::min(),
-                                             std::numeric_limits<Seed>::max());
-
-    for (size_t i = 0; i < K; i++) {
-      // generate until we find a new random seed
-      Seed rand_seed = 0;
-      bool already_exists = false;
-      do {
-        rand_seed = dist(rng);
-        for (size_t j = 0; j < i; j++)
-          already_exists |= seeds[j] == rand_seed;
-      } while (already_exists);
-
-      seeds[i] = rand_seed;
-    }
+  bool add_flow(const std::array<size_t, K> &indices) {
+    bool added = false;
+    detail::unroll<K>([&](auto i) {
+      auto &word = flow_set[indices[i] / 64];
+      const auto bit = std::uint64_t(1) << (indices[i] % 64);
+      added |= (word & bit) == 0;
+      word |= bit;
+    });
+    return added;
   }
 
+public:
   /**
-   * Count of keys in this InvertibleBloomDictionary
+   * Constructs a FlowEncoder whose dictionary has size buckets and whose flow
+   * set has flow_set_bits bits
    */
-  size_t size() const { return count; }
+  FlowEncoder(size_t size, size_t flow_set_bits,
+              unsigned int seed = std::random_device()())
+      : FlowEncoder(size, flow_set_bits, HashFn(), seed) {}
 
   /**
-   * Size of internal bucket directory
+   * Constructs a FlowEncoder whose dictionaries hash with copies of hasher,
+   * e.g., a SipHash13 keyed with a secret
    */
-  size_t directory_size() const { return buckets.size(); }
+  FlowEncoder(size_t size, size_t flow_set_bits, const HashFn &hasher,
+              unsigned int seed = std::random_device()())
+      : dictionary(size, hasher, seed), hasher(hasher), seed(seed),
+        flow_set((flow_set_bits + 63) / 64, 0),
+        flow_set_bits(flow_set_bits),
+        flow_set_seeds(detail::generate_seeds<std::uint64_t, K>(~seed)) {
+    assert(flow_set_bits > 0);
+  }
 
   /**
-   * Exposes internally used seeds, useful for testing or external serialization
+   * Count of distinct flows encoded since the last snapshot
    */
-  std::array<Seed, K> listSeeds() const { return seeds; }
+  size_t flow_count() const { return dictionary.size(); }
 
   /**
-   * Inserts a single key with its corresponding value
+   * Encodes n records, hashing and prefetching their flow set words and
+   * dictionary buckets in batches
    */
-  void insert(const Key &key, const Value &value) {
-    // keep track of indices we already set to avoid issues with two hashes
-    // going to same bucket
-    std::unordered_set<size_t> seen_indices;
-
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
-
-      // fix issue with hashfn hashing to same slot
-      if (seen_indices.find(index) != seen_indices.end())
-        continue;
-      seen_indices.insert(index);
+  void encode(const Key *keys, const Value *values, size_t n) {
+    std::array<std::array<size_t, K>, batch_size> indices, flow_indices;
+    std::array<std::uint64_t, batch_size> hashes;
+    for (size_t offset = 0; offset < n; offset += batch_size) {
+      const auto batch = std::min(batch_size, n - offset);
+      dictionary.hash_indices(keys + offset, batch, indices.data(),
+                              hashes.data());
+      for (size_t i = 0; i < batch; i++) {
+        flow_indices[i] = flow_set_indices(hashes[i]);
+        for (const auto &index : flow_indices[i])
+          __builtin_prefetch(&flow_set[index / 64]);
+        dictionary.prefetch(indices[i]);
+      }
 
-      auto &bucket = buckets[index];
-      bucket.cumulative_key ^= key;
-      bucket.cumulative_value ^= value;
-      bucket.count++;
+      for (size_t i = 0; i < batch; i++) {
+        const auto &key = keys[offset + i];
+        const auto &value = values[offset + i];
+        if (add_flow(flow_indices[i]))
+          dictionary.insert(key, value, indices[i]);
+        else
+          dictionary.accumulate(key, value, indices[i]);
+      }
     }
-
-    count += 1;
   }
 
   /**
-   * Checks whether a key is contained in this IBF. May return false positives,
-   * but never false negatives
+   * Returns the dictionary of all flows encoded so far and starts over with
+   * a freshly allocated one, e.g., to decode snapshots via listAll() off the
+   * encoding path. The dictionary moves out without copying buckets, but
+   * allocating and zeroing its successor as well as clearing the flow set
+   * costs O(directory + flow set). The flow set is reseeded, so that each
+   * epoch's false positives hit different flows
    */
-  ContainsResult contains(const Key &key) const {
-    bool might_exist = false;
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
+  Dictionary snapshot() {
+    auto result = std::exchange(
+        dictionary, Dictionary(dictionary.directory_size(), hasher, seed));
+    std::fill(flow_set.begin(), flow_set.end(), 0);
+    flow_set_seeds = detail::generate_seeds<std::uint64_t, K>(~seed - ++epoch);
+    return result;
+  }
+};
+/**
+ * FilterBank packs many tiny InvertibleBloomFilters (e.g., one per tenant)
+ * with identical geometry, i.e., cell count and seeds, into one arena. Cells
+ * are interleaved across groups of Lanes filters: cell i of the Lanes filters
+ * of a group is contiguous, so that bank wide operations, e.g., subtract(),
+ * and scanning a group for pure cells during decoding run in SIMD lanes.
+ *
+ * Counts are signed, as subtracting banks leaves cells of keys only contained
+ * in the subtrahend at negative counts. Decoding recovers those as removed
+ * keys
+ */
+template <class Key, class HashFn, size_t K = 3, size_t Lanes = 8,
+          class BucketCounter = std::int32_t>
+class FilterBank {
+  static_assert(std::is_signed_v<BucketCounter>);
+  static_assert(Lanes > 0 && Lanes <= 64);
 
-      const auto &bucket = buckets[index];
-      if (bucket.count == 1)
-        return key == bucket.cumulative_key ? ContainsResult::exists
-                                            : ContainsResult::not_found;
+  // keys hashed and prefetched at once by batched operations
+  static constexpr size_t batch_size = 32;
 
-      might_exist |= bucket.count > 1;
-    }
+  HashFn hasher{};
 
-    return might_exist ? ContainsResult::might_exist
-                       : ContainsResult::not_found;
+  using Seed = std::uint64_t;
+  std::array<Seed, K> seeds;
+
+  size_t filters;
+  size_t cells;
+  // cell c of filter f lives at (f / Lanes * cells + c) * Lanes + f % Lanes
+  std::vector<Key> keys;
+  std::vector<BucketCounter> counts;
+
+  size_t offset(size_t filter, size_t cell) const {
+    return (filter / Lanes * cells + cell) * Lanes + filter % Lanes;
   }
 
-  /**
-   * Returns the value associated with key if retrievable.
-   * Can return nullopt, eiher if key does not exist or if it's value is not
-   * uniquely identifyable.
-   */
-  std::optional<Value> get(const Key &key) const {
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
+  std::array<size_t, K> hash_indices(const Key &key) const {
+    std::uint64_t hash = 0;
+    if constexpr (!SeededHashFn<HashFn, Key>)
+      hash = hasher(key);
 
-      const auto &bucket = buckets[index];
-      if (bucket.count == 1)
-        return key == bucket.cumulative_key
-                   ? std::make_optional(bucket.cumulative_value)
-                   : std::nullopt;
-    }
+    std::array<size_t, K> indices;
+    detail::unroll<K>([&](auto i) {
+      if constexpr (SeededHashFn<HashFn, Key>)
+        indices[i] = detail::reduce(hasher(key, seeds[i]), cells);
+      else
+        indices[i] = detail::reduce(detail::mix(hash ^ seeds[i]), cells);
+    });
+    return indices;
+  }
 
-    return std::nullopt;
+  void update(size_t filter, const Key &key,
+              const std::array<size_t, K> &indices, BucketCounter delta) {
+    const auto duplicates = detail::duplicate_probes(indices);
+
+    detail::unroll<K>([&](auto i) {
+      if ((duplicates >> i) & 1)
+        return;
+
+      const auto at = offset(filter, indices[i]);
+      keys[at] ^= key;
+      counts[at] += delta;
+    });
   }
 
+  template <class Id>
+  void update(const Id *ids, const Key *batch_keys, size_t n,
+              BucketCounter delta) {
+    std::array<std::array<size_t, K>, batch_size> indices;
+    for (size_t start = 0; start < n; start += batch_size) {
+      const auto batch = std::min(batch_size, n - start);
+      for (size_t i = 0; i < batch; i++) {
+        indices[i] = hash_indices(batch_keys[start + i]);
+        for (const auto &index : indices[i]) {
+          const auto at = offset(ids[start + i], index);
+          __builtin_prefetch(&keys[at]);
+          __builtin_prefetch(&counts[at]);
+        }
+      }
+      for (size_t i = 0; i < batch; i++)
+        update(ids[start + i], batch_keys[start + i], indices[i], delta);
+    }
+  }
+
+public:
   /**
-   * Removes a single key and its corresponding value from
-   * the struct. Note that it is possible for this operation
-   * to fail (return false) not because the key doesn't exist,
-   * but because it is not uniquely identifyable
+   * Keys recovered from a filter: keys with positive count, i.e., inserted,
+   * and keys with negative count, i.e., only contained in a subtracted filter
    */
-  bool remove(Key key) {
-    const auto value = get(key);
-    if (!value)
-      return false;
-    assert(value.has_value());
+  struct Difference {
+    std::vector<Key> inserted;
+    std::vector<Key> removed;
+  };
+
+private:
+  /**
+   * Peels the filters of group whose bit is set in lanes simultaneously,
+   * storing the result of filter group * Lanes + lane in results[lane]
+   */
+  void decode_group(size_t group, std::uint64_t lanes,
+                    std::optional<Difference> *results) const {
+    const auto begin = group * cells * Lanes;
+    std::vector<Key> scratch_keys(keys.begin() + begin,
+                                  keys.begin() + begin + cells * Lanes);
+    std::vector<BucketCounter> scratch_counts(
+        counts.begin() + begin, counts.begin() + begin + cells * Lanes);
+    std::array<Difference, Lanes> differences;
 
-    // keep track of indices we already set to avoid issues with two hashes
-    // going to same bucket
-    std::unordered_set<size_t> seen_indices;
+    // Signed counts let cells look pure that are not, e.g., x - y + z, whose
+    // peeling may go on forever. No decodable filter holds more keys than
+    // cells, hence lanes exceeding that give up, which bounds the rounds
+    bool has_changed = true;
+    while (has_changed) {
+      has_changed = false;
+      for (size_t cell = 0; cell < cells; cell++) {
+        const auto *cell_counts = scratch_counts.data() + cell * Lanes;
 
-    for (const auto &seed : seeds) {
-      const auto index = hash_index(key, seed);
+        // lanes whose cell might be pure, computed across all lanes at once
+        std::uint64_t candidates = 0;
+        for (size_t lane = 0; lane < Lanes; lane++)
+          candidates |= std::uint64_t(cell_counts[lane] == 1 ||
+                                      cell_counts[lane] == -1)
+                        << lane;
+        candidates &= lanes;
 
-      // fix issue with hashfn hashing to same slot
-      if (seen_indices.find(index) != seen_indices.end())
-        continue;
-      seen_indices.insert(index);
+        for (; candidates != 0; candidates &= candidates - 1) {
+          const auto lane = std::countr_zero(candidates);
+          const auto key = scratch_keys[cell * Lanes + lane];
+          const auto sign = cell_counts[lane];
 
-      auto &bucket = buckets[index];
-      assert(bucket.count > 0);
+          // skip cells whose key does not hash to them
+          const auto indices = hash_indices(key);
+          if (std::find(indices.begin(), indices.end(), cell) == indices.end())
+            continue;
 
-      bucket.cumulative_key ^= key;
-      bucket.cumulative_value ^= *value;
-      bucket.count--;
+          auto &difference = differences[lane];
+          (sign > 0 ? difference.inserted : difference.removed).push_back(key);
+          has_changed = true;
+          if (difference.inserted.size() + difference.removed.size() > cells)
+            lanes &= ~(std::uint64_t(1) << lane);
+
+          const auto duplicates = detail::duplicate_probes(indices);
+          detail::unroll<K>([&](auto i) {
+            if ((duplicates >> i) & 1)
+              return;
+
+            const auto at = indices[i] * Lanes + lane;
+            scratch_keys[at] ^= key;
+            scratch_counts[at] -= sign;
+          });
+        }
+      }
     }
 
-    count -= 1;
-    return true;
+    for (size_t lane = 0; lane < Lanes; lane++) {
+      const auto filter = group * Lanes + lane;
+      if (filter >= filters)
+        break;
+      if (!((lanes >> lane) & 1))
+        continue;
+
+      bool decoded = true;
+      for (size_t cell = 0; cell < cells; cell++)
+        decoded &= scratch_counts[cell * Lanes + lane] == 0 &&
+                   scratch_keys[cell * Lanes + lane] == Key{};
+      results[lane] = decoded ? std::make_optional(std::move(differences[lane]))
+                              : std::nullopt;
+    }
   }
 
+public:
   /**
-   * Attempts to retrieve all key, value pairs. This operation might fail
-   * due to the probabilistic nature of this struct
+   * Constructs a bank of filters empty filters with cells cells each, all
+   * sharing the same seeds
    */
-  std::optional<std::vector<std::pair<Key, Value>>> listAll() const {
-    std::vector<std::pair<Key, Value>> res;
-    res.reserve(count);
+  FilterBank(size_t filters, size_t cells,
+             unsigned int seed = std::random_device()())
+      : filters(filters), cells(cells),
+        keys((filters + Lanes - 1) / Lanes * Lanes * cells, Key{}),
+        counts(keys.size(), 0) {
+    seeds = detail::generate_seeds<Seed, K>(seed);
+    detail::reseed(hasher, seed, seeds);
+  }
 
-    auto copy = *this;
+  size_t filter_count() const { return filters; }
+  size_t cell_count() const { return cells; }
+  std::array<Seed, K> listSeeds() const { return seeds; }
 
-    // TODO: come up with faster algorithm
-    bool finished = false;
-    bool has_changed = true;
-    while (!finished && has_changed) {
-      finished = true;
-      has_changed = false;
-      for (size_t i = 0; i < copy.buckets.size(); i++) {
-        const auto &bucket = copy.buckets[i];
+  void insert(size_t filter, const Key &key) {
+    update(filter, key, hash_indices(key), 1);
+  }
 
-        // skip already empty buckets
-        if (bucket.count == 0)
-          continue;
+  /**
+   * Inserts keys[i] into filter ids[i] for all i < n, hashing and prefetching
+   * cells in batches
+   */
+  template <class Id> void insert(const Id *ids, const Key *keys, size_t n) {
+    update(ids, keys, n, 1);
+  }
 
-        // skip ambiguous buckets
-        if (bucket.count > 1) {
-          finished = false;
-          continue;
-        }
+  /**
+   * Removes key from filter without verifying that it is contained, see
+   * InvertibleBloomFilter::erase()
+   */
+  void erase(size_t filter, const Key &key) {
+    update(filter, key, hash_indices(key), -1);
+  }
 
-        res.push_back({bucket.cumulative_key, bucket.cumulative_value});
-        has_changed = copy.remove(bucket.cumulative_key);
+  template <class Id> void erase(const Id *ids, const Key *keys, size_t n) {
+    update(ids, keys, n, -1);
+  }
 
-        assert(bucket.count == 0);
-      }
+  /**
+   * Subtracts each filter of other from the corresponding filter of this bank.
+   * Both banks must share their geometry, i.e., have been constructed with
+   * equal filter and cell counts as well as seeds
+   */
+  void subtract(const FilterBank &other) {
+    assert(filters == other.filters && cells == other.cells &&
+           seeds == other.seeds);
+    for (size_t i = 0; i < keys.size(); i++) {
+      keys[i] ^= other.keys[i];
+      counts[i] -= other.counts[i];
     }
+  }
 
-    if (!finished || res.size() != count)
-      return std::nullopt;
+  /**
+   * Decodes filter, returning nullopt if it does not decode completely. Only
+   * peels filter's lane, though copying its group still costs O(Lanes * cells)
+   */
+  std::optional<Difference> decode(size_t filter) const {
+    std::array<std::optional<Difference>, Lanes> results;
+    decode_group(filter / Lanes, std::uint64_t(1) << filter % Lanes,
+                 results.data());
+    return std::move(results[filter % Lanes]);
+  }
 
-    return std::make_optional(res);
+  /**
+   * Decodes all filters, see decode(filter)
+   */
+  std::vector<std::optional<Difference>> decode() const {
+    std::vector<std::optional<Difference>> results(
+        (filters + Lanes - 1) / Lanes * Lanes);
+    for (size_t group = 0; group * Lanes < filters; group++)
+      decode_group(group, ~std::uint64_t(0), results.data() + group * Lanes);
+    results.resize(filters);
+    return results;
   }
 };
 } // namespace ibf
@@ -0,0 +1,1072 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <invertible_bloom_filter.hpp>
+
+using namespace ibf;
+
+struct Murmur3Finalizer {
+  template <class T> constexpr T operator()(T key) const {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdLLU;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53LLU;
+    key ^= key >> 33;
+    return key;
+  }
+};
+
+// std::hash of integers on common standard libraries, i.e., no mixing at all
+struct IdentityHash {
+  template <class T> constexpr T operator()(T key) const { return key; }
+};
+
+// keeps the compiler from optimizing away benchmarked lookups
+static volatile std::uint64_t sink;
+
+/**
+ * Runs fn once and returns the elapsed time in nanoseconds per op
+ */
+template <class Fn> static double ns_per_op(size_t ops, Fn &&fn) {
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         static_cast<double>(ops);
+}
+
+/**
+ * Best of several runs of fn in nanoseconds per op. Only for fn without side
+ * effects on the benchmarked structure
+ */
+template <class Fn> static double best_ns_per_op(size_t ops, Fn &&fn) {
+  double best = std::numeric_limits<double>::max();
+  for (size_t run = 0; run < 5; run++)
+    best = std::min(best, ns_per_op(ops, fn));
+  return best;
+}
+
+static std::vector<std::uint64_t> random_keys(size_t n, std::uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<std::uint64_t> keys(n);
+  for (auto &key : keys)
+    key = rng();
+  return keys;
+}
+
+template <size_t K> static void bench_probe_kernels(size_t directory_size) {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer, K>;
+
+  // repeat lookups on small directories for stable timings
+  const auto rounds = std::max<size_t>(1, (size_t(1) << 22) / directory_size);
+  const auto keys = random_keys(directory_size / 2, K);
+  const auto misses = random_keys(directory_size / 2, K + 1000);
+
+  IBF ibf(directory_size, 0);
+  const auto insert = ns_per_op(keys.size(), [&] {
+    for (const auto &key : keys)
+      ibf.insert(key);
+  });
+  const auto contains_hit = best_ns_per_op(rounds * keys.size(), [&] {
+    std::uint64_t found = 0;
+    for (size_t round = 0; round < rounds; round++)
+      for (const auto &key : keys)
+        found += ibf.contains(key);
+    sink = found;
+  });
+  const auto contains_miss = best_ns_per_op(rounds * misses.size(), [&] {
+    std::uint64_t found = 0;
+    for (size_t round = 0; round < rounds; round++)
+      for (const auto &key : misses)
+        found += ibf.contains(key);
+    sink = found;
+  });
+  const auto remove = ns_per_op(keys.size(), [&] {
+    std::uint64_t removed = 0;
+    for (const auto &key : keys)
+      removed += ibf.remove(key);
+    sink = removed;
+  });
+
+  std::cout << std::setw(4) << K << std::setw(12) << insert << std::setw(14)
+            << contains_hit << std::setw(15) << contains_miss << std::setw(12)
+            << remove << std::endl;
+}
+
+/**
+ * ns per op of the per key operations for K = 2..8, with the directory loaded
+ * with directory_size / 2 keys
+ */
+static void bench_probe_kernels(size_t directory_size) {
+  std::cout << "probe kernels, directory size " << directory_size
+            << ", ns/op" << std::endl;
+  std::cout << std::setw(4) << "K" << std::setw(12) << "insert"
+            << std::setw(14) << "contains hit" << std::setw(15)
+            << "contains miss" << std::setw(12) << "remove" << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+
+  bench_probe_kernels<2>(directory_size);
+  bench_probe_kernels<3>(directory_size);
+  bench_probe_kernels<4>(directory_size);
+  bench_probe_kernels<5>(directory_size);
+  bench_probe_kernels<6>(directory_size);
+  bench_probe_kernels<7>(directory_size);
+  bench_probe_kernels<8>(directory_size);
+  std::cout << std::endl;
+}
+
+static void bench_probe_kernels() {
+  // cache resident and far larger than typical last level caches
+  bench_probe_kernels(size_t(1) << 14);
+  bench_probe_kernels(size_t(1) << 23);
+}
+
+/**
+ * Smallest amount of buckets per key (in steps of 0.01) at which every one of
+ * trials filters, constructed by make_filter(directory_size, seed) and filled
+ * with keys random keys, could list all its keys
+ */
+template <class MakeFilter>
+static double buckets_per_key(size_t keys, size_t trials,
+                              MakeFilter &&make_filter) {
+  for (size_t percent = 100; percent <= 150; percent++) {
+    bool all_decoded = true;
+    for (size_t trial = 0; trial < trials && all_decoded; trial++) {
+      auto filter = make_filter(keys * percent / 100, trial);
+      for (const auto &key : random_keys(keys, trial))
+        filter.insert(key);
+      all_decoded = filter.listAll().has_value();
+    }
+    if (all_decoded)
+      return static_cast<double>(percent) / 100.0;
+  }
+  return std::numeric_limits<double>::infinity();
+}
+
+/**
+ * Buckets per key required by InvertibleBloomFilter and
+ * SpatiallyCoupledInvertibleBloomFilters with varying amounts of windows
+ * (K = 3) to decode all of 10 trials
+ */
+static void bench_coupled_threshold() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  using SCIBF =
+      SpatiallyCoupledInvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+
+  constexpr size_t trials = 10;
+
+  std::cout << "buckets per key to decode " << trials << "/" << trials
+            << " trials, K = 3" << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+
+  for (const size_t keys : {size_t(100000), size_t(1000000)}) {
+    std::cout << keys << " keys" << std::endl;
+    std::cout << "  uncoupled              "
+              << buckets_per_key(keys, trials,
+                                 [](size_t size, size_t seed) {
+                                   return IBF(size, seed + 1);
+                                 })
+              << std::endl;
+
+    for (const size_t windows : {size_t(30), size_t(100), size_t(300)}) {
+      std::cout << "  coupled, " << std::setw(3) << windows << " windows   "
+                << buckets_per_key(keys, trials,
+                                   [&](size_t size, size_t seed) {
+                                     return SCIBF(size, windows, seed + 1);
+                                   })
+                << std::endl;
+    }
+  }
+  std::cout << std::endl;
+}
+
+/**
+ * Buckets per key required by an InvertibleBloomFilter with K hash functions
+ * under DegreePolicy to decode all trials, next to the average degree
+ */
+template <size_t K, class DegreePolicy>
+static void bench_degree(const std::string &name, size_t keys,
+                         size_t trials) {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer, K,
+                                    std::uint16_t, DegreePolicy>;
+
+  std::cout << "  " << std::left << std::setw(24) << name << std::right
+            << "avg degree " << detail::average_degree<K, DegreePolicy>()
+            << ", "
+            << buckets_per_key(keys, trials,
+                               [](size_t size, size_t seed) {
+                                 return IBF(size, seed + 1);
+                               })
+            << " buckets per key" << std::endl;
+}
+
+/**
+ * Buckets per key required by irregular degree distributions compared to the
+ * regular K = 3 default at roughly equal average work per key
+ */
+static void bench_degree_threshold() {
+  constexpr size_t trials = 10;
+
+  std::cout << "buckets per key to decode " << trials << "/" << trials
+            << " trials" << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+
+  for (const size_t keys : {size_t(100000), size_t(1000000)}) {
+    std::cout << keys << " keys" << std::endl;
+    bench_degree<3, RegularDegree>("regular K = 3", keys, trials);
+    bench_degree<4, RegularDegree>("regular K = 4", keys, trials);
+    bench_degree<4, MixedDegree<3, 50>>("3 | 4 @ 50%", keys, trials);
+    bench_degree<6, MixedDegree<3, 10>>("3 | 6 @ 10%", keys, trials);
+    bench_degree<8, MixedDegree<3, 10>>("3 | 8 @ 10%", keys, trials);
+    bench_degree<12, MixedDegree<3, 5>>("3 | 12 @ 5%", keys, trials);
+    bench_degree<21, MixedDegree<3, 3>>("3 | 21 @ 3%", keys, trials);
+  }
+  std::cout << std::endl;
+}
+
+// bucket index of key's probe under seed for a family of hash functions
+template <class HashFn>
+static size_t probe_index(std::uint64_t key, std::uint64_t seed,
+                          size_t directory_size) {
+  return HashFn{}(key, seed) % directory_size;
+}
+
+/**
+ * Derives probes by only xor-ing the seed into HashFn's hash, as filters used
+ * to do for unseeded hash functions
+ */
+template <class HashFn> struct SeedXored {
+  HashFn hasher{};
+
+  std::uint64_t operator()(std::uint64_t key, std::uint64_t seed) const {
+    return hasher(key) ^ seed;
+  }
+};
+
+/**
+ * Pairs of keys sharing the bucket of their first probe that also share the
+ * bucket of their second probe, relative to the amount expected for
+ * independent probes. 1.00 means independent, directory_size means the second
+ * probe is determined by the first
+ */
+template <class HashFn>
+static double probe_correlation(const std::vector<std::uint64_t> &keys,
+                                size_t directory_size) {
+  std::vector<std::pair<size_t, size_t>> probes;
+  probes.reserve(keys.size());
+  for (const auto &key : keys)
+    probes.emplace_back(probe_index<HashFn>(key, 0x9e3779b97f4a7c15LLU,
+                                            directory_size),
+                        probe_index<HashFn>(key, 0xd1b54a32d192ed03LLU,
+                                            directory_size));
+  std::sort(probes.begin(), probes.end());
+
+  double first_pairs = 0, both_pairs = 0;
+  for (size_t i = 0, j = 0; i < probes.size(); i = j) {
+    for (j = i; j < probes.size() && probes[j].first == probes[i].first; j++)
+      ;
+    first_pairs += double(j - i) * double(j - i - 1) / 2;
+    for (size_t k = i, l = i; k < j; k = l) {
+      for (l = k; l < j && probes[l] == probes[k]; l++)
+        ;
+      both_pairs += double(l - k) * double(l - k - 1) / 2;
+    }
+  }
+  return both_pairs / first_pairs * static_cast<double>(directory_size);
+}
+
+/**
+ * Chi-squared statistic of the first probe's bucket loads divided by its
+ * degrees of freedom. Around 1.00 for uniformly distributed probes
+ */
+template <class HashFn>
+static double probe_uniformity(const std::vector<std::uint64_t> &keys,
+                               size_t directory_size) {
+  std::vector<size_t> loads(directory_size, 0);
+  for (const auto &key : keys)
+    loads[probe_index<HashFn>(key, 0x9e3779b97f4a7c15LLU, directory_size)]++;
+
+  const auto expected =
+      static_cast<double>(keys.size()) / static_cast<double>(directory_size);
+  double chi_squared = 0;
+  for (const auto &load : loads)
+    chi_squared += (double(load) - expected) * (double(load) - expected);
+  return chi_squared / expected / static_cast<double>(directory_size - 1);
+}
+
+/**
+ * Buckets per key (in steps of 0.05) at which every one of trials
+ * InvertibleBloomFilters with a fixed directory_size, filled with either
+ * random or consecutive keys, could list all their keys
+ */
+template <class HashFn>
+static double fixed_size_buckets_per_key(size_t directory_size, size_t trials,
+                                         bool consecutive) {
+  using IBF = InvertibleBloomFilter<std::uint64_t, HashFn>;
+
+  for (size_t percent = 100; percent <= 400; percent += 5) {
+    const auto keys = directory_size * 100 / percent;
+    bool all_decoded = true;
+    for (size_t trial = 0; trial < trials && all_decoded; trial++) {
+      IBF ibf(directory_size, trial + 1);
+      if (consecutive)
+        for (std::uint64_t key = 0; key < keys; key++)
+          ibf.insert((std::uint64_t(trial) << 32) + key);
+      else
+        for (const auto &key : random_keys(keys, trial))
+          ibf.insert(key);
+      all_decoded = ibf.listAll().has_value();
+    }
+    if (all_decoded)
+      return static_cast<double>(percent) / 100.0;
+  }
+  return std::numeric_limits<double>::infinity();
+}
+
+template <class HashFn> static void bench_hash_family(const std::string &name) {
+  constexpr size_t pow2_size = size_t(1) << 16;
+  constexpr size_t prime_size = 65521;
+  constexpr size_t trials = 10;
+
+  std::vector<std::uint64_t> consecutive(size_t(1) << 20);
+  for (size_t i = 0; i < consecutive.size(); i++)
+    consecutive[i] = i;
+  const auto random = random_keys(consecutive.size(), 0);
+
+  std::cout << std::left << std::setw(26) << name << std::right;
+  for (const auto size : {pow2_size, prime_size})
+    std::cout << std::setw(10) << probe_correlation<HashFn>(random, size)
+              << std::setw(10) << probe_correlation<HashFn>(consecutive, size)
+              << std::setw(10) << probe_uniformity<HashFn>(consecutive, size)
+              << std::setw(10)
+              << fixed_size_buckets_per_key<HashFn>(size, trials, false)
+              << std::setw(10)
+              << fixed_size_buckets_per_key<HashFn>(size, trials, true);
+  std::cout << std::endl;
+}
+
+/**
+ * Statistical properties of the ways filters derive their K probes: probe
+ * correlation for random and consecutive keys, uniformity of consecutive keys
+ * (chi-squared / df) and buckets per key to decode 10/10 trials of random and
+ * consecutive keys, for a power of two and a prime directory size (K = 3)
+ */
+static void bench_hash_families() {
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << std::setw(26) << "" << std::setw(50) << "2^16 buckets"
+            << std::setw(50) << "65521 buckets" << std::endl;
+  std::cout << std::left << std::setw(26) << "family" << std::right;
+  for (size_t i = 0; i < 2; i++)
+    std::cout << std::setw(10) << "corr" << std::setw(10) << "corr seq"
+              << std::setw(10) << "chi2 seq" << std::setw(10) << "bpk"
+              << std::setw(10) << "bpk seq";
+  std::cout << std::endl;
+
+  bench_hash_family<SeedXored<Murmur3Finalizer>>("SeedXored, murmur3");
+  bench_hash_family<SeedXored<IdentityHash>>("SeedXored, identity");
+  bench_hash_family<SeedMixed<Murmur3Finalizer>>("SeedMixed, murmur3");
+  bench_hash_family<SeedMixed<IdentityHash>>("SeedMixed, identity");
+  bench_hash_family<SeedMultiplied<Murmur3Finalizer>>(
+      "SeedMultiplied, murmur3");
+  bench_hash_family<SeedMultiplied<IdentityHash>>("SeedMultiplied, identity");
+  bench_hash_family<SimpleTabulation<std::uint64_t>>("SimpleTabulation");
+  std::cout << std::endl;
+}
+
+template <class HashFn>
+static void bench_hash_speed(const std::string &name, size_t directory_size) {
+  using IBF = InvertibleBloomFilter<std::uint64_t, HashFn>;
+
+  // consecutive keys, half of them inserted
+  std::vector<std::uint64_t> keys(directory_size / 2), lookups(directory_size);
+  for (size_t i = 0; i < lookups.size(); i++)
+    lookups[i] = i;
+  std::copy(lookups.begin(), lookups.begin() + keys.size(), keys.begin());
+  std::vector<ContainsResult> results(lookups.size());
+
+  IBF single(directory_size, 0), batched(directory_size, 0);
+  const auto insert = ns_per_op(keys.size(), [&] {
+    for (const auto &key : keys)
+      single.insert(key);
+  });
+  const auto batch_insert = ns_per_op(
+      keys.size(), [&] { batched.insert(keys.data(), keys.size()); });
+  const auto contains = best_ns_per_op(lookups.size(), [&] {
+    std::uint64_t found = 0;
+    for (const auto &key : lookups)
+      found += single.contains(key);
+    sink = found;
+  });
+  const auto batch_contains = best_ns_per_op(lookups.size(), [&] {
+    batched.contains(lookups.data(), lookups.size(), results.data());
+    sink = results.back();
+  });
+
+  std::cout << std::left << std::setw(26) << name << std::right
+            << std::setw(12) << insert << std::setw(14) << batch_insert
+            << std::setw(12) << contains << std::setw(16) << batch_contains
+            << std::endl;
+}
+
+/**
+ * ns per op of single and batched inserts and lookups (K = 3) of consecutive
+ * keys using different hash functions, including the keyed SipHash13
+ */
+static void bench_hash_speed() {
+  std::cout << std::fixed << std::setprecision(1);
+  for (const auto directory_size : {size_t(1) << 14, size_t(1) << 23}) {
+    std::cout << "hash speed, directory size " << directory_size << ", ns/op"
+              << std::endl;
+    std::cout << std::left << std::setw(26) << "hash function" << std::right
+              << std::setw(12) << "insert" << std::setw(14) << "batch insert"
+              << std::setw(12) << "contains" << std::setw(16)
+              << "batch contains" << std::endl;
+
+    bench_hash_speed<Murmur3Finalizer>("murmur3 (SeedMixed)", directory_size);
+    bench_hash_speed<SeedMultiplied<Murmur3Finalizer>>(
+        "SeedMultiplied, murmur3", directory_size);
+    bench_hash_speed<SimpleTabulation<std::uint64_t>>("SimpleTabulation",
+                                                      directory_size);
+    bench_hash_speed<SipHash13<std::uint64_t>>("SipHash13 (keyed)",
+                                               directory_size);
+    std::cout << std::endl;
+  }
+}
+
+/**
+ * Replays a stream of inserts in which 9 out of 10 keys are removed again 64
+ * inserts later, returning ns per insert or remove
+ */
+template <class Filter> static double short_lived_ns_per_op(Filter &filter) {
+  constexpr size_t inserts = size_t(1) << 21;
+  constexpr size_t lifetime = 64;
+  const auto keys = random_keys(inserts, 1);
+
+  size_t ops = 0;
+  const auto ns = ns_per_op(1, [&] {
+    for (size_t i = 0; i < inserts; i++) {
+      filter.insert(keys[i]);
+      ops++;
+      if (i >= lifetime && (i - lifetime) % 10 != 0) {
+        sink = filter.remove(keys[i - lifetime]);
+        ops++;
+      }
+    }
+  });
+  return ns / static_cast<double>(ops);
+}
+
+/**
+ * ns per op of short lived keys in a large filter holding 2^22 keys, with
+ * and without cache resident front tiers
+ */
+static void bench_two_tier() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  constexpr size_t directory_size = size_t(1) << 24;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "short lived keys, directory size " << directory_size
+            << ", ns/op" << std::endl;
+
+  const auto resident = random_keys(size_t(1) << 22, 0);
+  {
+    IBF ibf(directory_size, 0);
+    ibf.insert(resident.data(), resident.size());
+    std::cout << "  single tier                    "
+              << short_lived_ns_per_op(ibf) << std::endl;
+  }
+  for (const size_t front_size : {size_t(1) << 12, size_t(1) << 14}) {
+    TwoTierFilter<IBF> filter(directory_size, front_size, front_size / 8, 0);
+    for (const auto &key : resident)
+      filter.insert(key);
+    filter.flush();
+    std::cout << "  two tier, " << std::setw(5) << front_size
+              << " front buckets   " << short_lived_ns_per_op(filter)
+              << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+/**
+ * Million records per second a FlowEncoder encodes, and the time to decode
+ * its snapshot, for 2^24 records spread over varying amounts of flows
+ */
+static void bench_flow_encoder() {
+  using Encoder = FlowEncoder<std::uint64_t, std::uint64_t, Murmur3Finalizer>;
+  constexpr size_t records = size_t(1) << 24;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "flow encoder, " << records << " records" << std::endl;
+  std::cout << std::setw(10) << "flows" << std::setw(16) << "records/s (M)"
+            << std::setw(14) << "decode (ms)" << std::setw(10) << "decoded"
+            << std::endl;
+
+  for (const size_t flows : {size_t(1) << 14, size_t(1) << 17,
+                             size_t(1) << 20}) {
+    const auto flow_keys = random_keys(flows, 0);
+    std::mt19937_64 rng(1);
+    std::vector<std::uint64_t> keys(records), values(records);
+    for (size_t i = 0; i < records; i++) {
+      keys[i] = flow_keys[rng() % flows];
+      values[i] = 64 + rng() % 1437;
+    }
+
+    Encoder encoder(flows * 13 / 10, flows * 16, 0);
+    const auto ns = ns_per_op(records, [&] {
+      encoder.encode(keys.data(), values.data(), records);
+    });
+
+    std::optional<std::vector<std::pair<std::uint64_t, std::uint64_t>>> res;
+    const auto snapshot = encoder.snapshot();
+    const auto decode_ms =
+        ns_per_op(1, [&] { res = snapshot.listAll(); }) / 1e6;
+
+    std::cout << std::setw(10) << flows << std::setw(16) << 1e3 / ns
+              << std::setw(14) << decode_ms << std::setw(10)
+              << (res ? "yes" : "no") << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+template <class Filter>
+static void bench_runtime_k(const std::string &name, Filter &filter,
+                            const std::vector<std::uint64_t> &keys) {
+  std::vector<ContainsResult> results(keys.size());
+
+  const auto insert = ns_per_op(keys.size(), [&] {
+    for (const auto &key : keys)
+      filter.insert(key);
+  });
+  const auto contains = best_ns_per_op(keys.size(), [&] {
+    std::uint64_t found = 0;
+    for (const auto &key : keys)
+      found += filter.contains(key);
+    sink = found;
+  });
+  filter.clear();
+  const auto batch_insert =
+      ns_per_op(keys.size(), [&] { filter.insert(keys.data(), keys.size()); });
+  const auto batch_contains = best_ns_per_op(keys.size(), [&] {
+    filter.contains(keys.data(), keys.size(), results.data());
+    sink = results.back();
+  });
+
+  std::cout << std::left << std::setw(16) << name << std::right
+            << std::setw(10) << insert << std::setw(10) << contains
+            << std::setw(14) << batch_insert << std::setw(16)
+            << batch_contains << std::endl;
+}
+
+/**
+ * Baseline for bench_paged_directory: InvertibleBloomFilter's buckets, hashing
+ * and lazily probing contains(), over a flat std::vector directory without
+ * pages, copy on write or a sparse mode
+ */
+struct FlatFilter {
+  struct Bucket {
+    std::uint64_t cumulative_key = 0;
+    std::uint16_t count = 0;
+  };
+
+  Murmur3Finalizer hasher;
+  std::array<std::uint64_t, 3> seeds{0x9e3779b97f4a7c15, 0xbf58476d1ce4e5b9,
+                                     0x94d049bb133111eb};
+  std::vector<Bucket> buckets;
+
+  explicit FlatFilter(size_t size) : buckets(size) {}
+
+  size_t index(std::uint64_t hash, size_t i) const {
+    return detail::reduce(detail::mix(hash ^ seeds[i]), buckets.size());
+  }
+
+  void insert(std::uint64_t key) {
+    const auto hash = hasher(key);
+    std::array<size_t, 3> indices;
+    for (size_t i = 0; i < 3; i++)
+      indices[i] = index(hash, i);
+    const auto duplicates = detail::duplicate_probes(indices);
+    for (size_t i = 0; i < 3; i++) {
+      if ((duplicates >> i) & 1)
+        continue;
+      buckets[indices[i]].cumulative_key ^= key;
+      buckets[indices[i]].count++;
+    }
+  }
+
+  ContainsResult contains(std::uint64_t key) const {
+    const auto hash = hasher(key);
+    bool might_exist = false;
+    for (size_t i = 0; i < 3; i++) {
+      const auto &bucket = buckets[index(hash, i)];
+      if (bucket.count == 1)
+        return key == bucket.cumulative_key ? ContainsResult::exists
+                                            : ContainsResult::not_found;
+      might_exist |= bucket.count > 1;
+    }
+    return might_exist ? ContainsResult::might_exist
+                       : ContainsResult::not_found;
+  }
+};
+
+/**
+ * ns per insert() and contains() of InvertibleBloomFilter, whose paged
+ * directory supports snapshots and sparse mode, compared to FlatFilter's
+ * plain std::vector directory, at load 0.5 (K = 3)
+ */
+static void bench_paged_directory() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "paged vs flat directory, ns/op" << std::endl;
+  std::cout << std::setw(12) << "directory" << std::setw(14) << "paged insert"
+            << std::setw(14) << "flat insert" << std::setw(16)
+            << "paged contains" << std::setw(16) << "flat contains"
+            << std::endl;
+
+  for (const size_t directory_size :
+       {size_t(1) << 14, size_t(1) << 20, size_t(1) << 24}) {
+    const auto keys = random_keys(directory_size / 2, 0);
+    const auto lookups = random_keys(directory_size / 2, 1);
+
+    const auto insert = [&](auto &filter) {
+      return ns_per_op(keys.size(), [&] {
+        for (const auto &key : keys)
+          filter.insert(key);
+      });
+    };
+    const auto contains = [&](const auto &filter) {
+      return best_ns_per_op(2 * keys.size(), [&] {
+        std::uint64_t found = 0;
+        for (const auto &key : keys)
+          found += filter.contains(key) == ContainsResult::exists;
+        for (const auto &key : lookups)
+          found += filter.contains(key) == ContainsResult::exists;
+        sink = found;
+      });
+    };
+
+    // best of several fresh filters, as inserting mutates them
+    double paged_insert = std::numeric_limits<double>::max();
+    double flat_insert = paged_insert;
+    for (size_t run = 0; run < 5; run++) {
+      IBF paged(directory_size, 0);
+      paged_insert = std::min(paged_insert, insert(paged));
+      FlatFilter flat(directory_size);
+      flat_insert = std::min(flat_insert, insert(flat));
+    }
+
+    IBF paged(directory_size, 0);
+    FlatFilter flat(directory_size);
+    for (const auto &key : keys) {
+      paged.insert(key);
+      flat.insert(key);
+    }
+
+    std::cout << std::setw(12) << directory_size << std::setw(14)
+              << paged_insert << std::setw(14) << flat_insert << std::setw(16)
+              << contains(paged) << std::setw(16) << contains(flat)
+              << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+/**
+ * ns per op of statically dispatched InvertibleBloomFilters compared to
+ * RuntimeKInvertibleBloomFilter's runtime dispatch
+ */
+static void bench_runtime_k() {
+  using RuntimeK = RuntimeKInvertibleBloomFilter<std::uint64_t,
+                                                 Murmur3Finalizer>;
+  constexpr size_t directory_size = size_t(1) << 14;
+  const auto keys = random_keys(directory_size / 2, 0);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "runtime K, directory size " << directory_size << ", ns/op"
+            << std::endl;
+  std::cout << std::left << std::setw(16) << "filter" << std::right
+            << std::setw(10) << "insert" << std::setw(10) << "contains"
+            << std::setw(14) << "batch insert" << std::setw(16)
+            << "batch contains" << std::endl;
+
+  InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer, 3> static3(
+      directory_size, 0);
+  bench_runtime_k("static K = 3", static3, keys);
+  RuntimeK runtime3(directory_size, 3, 0);
+  bench_runtime_k("runtime K = 3", runtime3, keys);
+
+  InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer, 5> static5(
+      directory_size, 0);
+  bench_runtime_k("static K = 5", static5, keys);
+  RuntimeK runtime5(directory_size, 5, 0);
+  bench_runtime_k("runtime K = 5", runtime5, keys);
+  std::cout << std::endl;
+}
+
+template <size_t Lanes>
+static void bench_filter_bank(const std::vector<std::uint32_t> &ids,
+                              const std::vector<std::uint64_t> &keys,
+                              size_t filters, size_t cells) {
+  FilterBank<std::uint64_t, Murmur3Finalizer, 3, Lanes> bank(filters, cells,
+                                                            0);
+  const auto insert = ns_per_op(keys.size(), [&] {
+    bank.insert(ids.data(), keys.data(), keys.size());
+  });
+  size_t decoded = 0;
+  const auto decode = ns_per_op(filters, [&] {
+    for (const auto &result : bank.decode())
+      decoded += result.has_value();
+  });
+
+  std::cout << "  bank, " << std::setw(2) << Lanes << " lanes      "
+            << std::setw(10) << insert << std::setw(14) << decode
+            << std::setw(10) << decoded << std::endl;
+}
+
+/**
+ * ns per key inserted and per filter decoded of many tiny filters, kept as
+ * separate InvertibleBloomFilters or packed into a FilterBank
+ */
+static void bench_filter_bank() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  constexpr size_t filters = 1 << 14, cells = 64, keys_per_filter = 32;
+
+  std::mt19937_64 rng(0);
+  std::vector<std::uint32_t> ids(filters * keys_per_filter);
+  for (auto &id : ids)
+    id = rng() % filters;
+  const auto keys = random_keys(ids.size(), 1);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << filters << " filters, " << cells << " cells" << std::endl;
+  std::cout << std::setw(32) << "insert (ns)" << std::setw(14)
+            << "decode (ns)" << std::setw(10) << "decoded" << std::endl;
+
+  {
+    std::vector<IBF> separate(filters, IBF(cells, 0));
+    const auto insert = ns_per_op(keys.size(), [&] {
+      for (size_t i = 0; i < keys.size(); i++)
+        separate[ids[i]].insert(keys[i]);
+    });
+    size_t decoded = 0;
+    const auto decode = ns_per_op(filters, [&] {
+      for (const auto &filter : separate)
+        decoded += filter.listAll().has_value();
+    });
+    std::cout << "  separate filters    " << std::setw(10) << insert
+              << std::setw(14) << decode << std::setw(10) << decoded
+              << std::endl;
+  }
+  bench_filter_bank<8>(ids, keys, filters, cells);
+  bench_filter_bank<16>(ids, keys, filters, cells);
+  std::cout << std::endl;
+}
+
+/**
+ * Time to decode or fail to decode filters of varying load with and without
+ * early_abort, and how often either succeeds
+ */
+static void bench_early_abort() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  constexpr size_t directory_size = 100000, trials = 20;
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "early abort, directory size " << directory_size << std::endl;
+  std::cout << std::setw(6) << "load" << std::setw(14) << "listAll (ms)"
+            << std::setw(10) << "decoded" << std::setw(14) << "early (ms)"
+            << std::setw(10) << "decoded" << std::endl;
+
+  for (const double load : {0.5, 0.8, 0.81, 0.82, 0.83, 0.9, 1.5}) {
+    double plain_ms = 0, early_ms = 0;
+    size_t plain_decoded = 0, early_decoded = 0;
+    for (size_t trial = 0; trial < trials; trial++) {
+      IBF ibf(directory_size, trial);
+      const auto keys =
+          random_keys(static_cast<size_t>(load * directory_size), trial);
+      ibf.insert(keys.data(), keys.size());
+
+      plain_ms += ns_per_op(trials, [&] {
+        plain_decoded += ibf.listAll().has_value();
+      }) / 1e6;
+      early_ms += ns_per_op(trials, [&] {
+        early_decoded += ibf.listAll(early_abort).has_value();
+      }) / 1e6;
+    }
+
+    std::cout << std::setw(6) << load << std::setw(14) << plain_ms
+              << std::setw(10) << plain_decoded << std::setw(14) << early_ms
+              << std::setw(10) << early_decoded << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+/**
+ * Decoding filters beyond the peeling threshold by solving their residual
+ * over GF(2) among candidates (the filter's keys plus as many others), versus
+ * re-sending a filter large enough to peel, i.e., 1.3 buckets per key
+ */
+static void bench_gf2_solve() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  constexpr size_t directory_size = 4000, trials = 10;
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "GF(2) residual solving, directory size " << directory_size
+            << std::endl;
+  std::cout << std::setw(6) << "load" << std::setw(10) << "peeled"
+            << std::setw(10) << "solved" << std::setw(12) << "solve (ms)"
+            << std::setw(16) << "resend (bytes)" << std::setw(16)
+            << "resend (ms)" << std::endl;
+
+  for (const double load : {0.8, 0.9, 1.0, 1.1, 1.2}) {
+    const auto n = static_cast<size_t>(load * directory_size);
+    size_t peeled = 0, solved = 0;
+    double solve_ms = 0, resend_ms = 0;
+    for (size_t trial = 0; trial < trials; trial++) {
+      auto candidates = random_keys(2 * n, trial);
+      IBF ibf(directory_size, trial), larger(n * 13 / 10, trial);
+      ibf.insert(candidates.data(), n);
+      larger.insert(candidates.data(), n);
+
+      peeled += ibf.listAll().has_value();
+      solve_ms += ns_per_op(trials, [&] {
+        solved +=
+            ibf.listAll(candidates.data(), candidates.size()).has_value();
+      }) / 1e6;
+      resend_ms +=
+          ns_per_op(trials, [&] { sink = larger.listAll()->size(); }) / 1e6;
+    }
+
+    // buckets hold a key and a 16-bit count, padded to 16 bytes
+    const auto resend_bytes = n * 13 / 10 * 16;
+    std::cout << std::setw(6) << load << std::setw(10) << peeled
+              << std::setw(10) << solved << std::setw(12) << solve_ms
+              << std::setw(16) << resend_bytes << std::setw(16) << resend_ms
+              << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+/**
+ * Keys a StashedFilter maintained every 1/64th of its directory size stashes
+ * to keep listAll() from failing, its insert and decode time, and how many of
+ * trials plain filters of the same directory size decode
+ */
+static void bench_stash() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  constexpr size_t directory_size = 100000, trials = 10;
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "stashed filters, directory size " << directory_size
+            << std::endl;
+  std::cout << std::setw(6) << "load" << std::setw(10) << "decoded"
+            << std::setw(12) << "stashed" << std::setw(16) << "listAll (ms)"
+            << std::setw(18) << "insert (ns/key)" << std::endl;
+
+  for (const double load : {0.75, 0.8, 0.82, 0.85, 0.9}) {
+    const auto n = static_cast<size_t>(load * directory_size);
+    size_t decoded = 0, stashed = 0;
+    double list_ms = 0, insert_ns = 0;
+    for (size_t trial = 0; trial < trials; trial++) {
+      const auto keys = random_keys(n, trial);
+      IBF ibf(directory_size, trial);
+      ibf.insert(keys.data(), keys.size());
+      decoded += ibf.listAll().has_value();
+
+      // maintained every directory_size / 64 keys
+      StashedFilter<IBF> filter(directory_size, directory_size / 64, trial);
+      insert_ns += ns_per_op(n, [&] {
+        for (const auto &key : keys)
+          filter.insert(key);
+        filter.maintain();
+      });
+      stashed += filter.stash_size();
+      list_ms += ns_per_op(1, [&] { sink = filter.listAll()->size(); }) / 1e6;
+    }
+
+    std::cout << std::setw(6) << load << std::setw(10) << decoded
+              << std::setw(12) << stashed / trials << std::setw(16)
+              << list_ms / trials << std::setw(18) << insert_ns / trials
+              << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+/**
+ * Bytes and ns per lookup of an InvertibleBloomDictionary before and after
+ * freezing it, at several loads of a directory exceeding the LLC
+ */
+static void bench_freeze() {
+  using IBD = InvertibleBloomDictionary<std::uint64_t, std::uint64_t,
+                                        Murmur3Finalizer>;
+  constexpr size_t directory_size = size_t(1) << 24;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "frozen dictionaries, directory size " << directory_size
+            << std::endl;
+  std::cout << std::setw(6) << "load" << std::setw(12) << "MiB"
+            << std::setw(12) << "frozen" << std::setw(12) << "get hit"
+            << std::setw(12) << "frozen" << std::setw(12) << "get miss"
+            << std::setw(12) << "frozen" << std::endl;
+
+  constexpr size_t lookups = size_t(1) << 20;
+  const auto misses = random_keys(lookups, 1000);
+  for (const double load : {0.25, 0.5, 0.75, 0.8}) {
+    const auto keys =
+        random_keys(static_cast<size_t>(load * directory_size), 0);
+    IBD ibd(directory_size, 0);
+    ibd.insert(keys.data(), keys.data(), keys.size());
+    const auto frozen = ibd.freeze();
+
+    const auto get_ns = [&](const auto &dictionary, const auto &queries) {
+      return best_ns_per_op(lookups, [&] {
+        std::uint64_t found = 0;
+        for (size_t i = 0; i < lookups; i++)
+          found += dictionary.get(queries[i]).value_or(0);
+        sink = found;
+      });
+    };
+
+    // 8 byte key and value plus 2 byte count, padded to 24 bytes
+    const auto bytes = directory_size * 24;
+    std::cout << std::setw(6) << std::setprecision(2) << load
+              << std::setprecision(1) << std::setw(12) << bytes / double(1 << 20)
+              << std::setw(12) << frozen.byte_size() / double(1 << 20)
+              << std::setw(12) << get_ns(ibd, keys) << std::setw(12)
+              << get_ns(frozen, keys) << std::setw(12) << get_ns(ibd, misses)
+              << std::setw(12) << get_ns(frozen, misses) << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+template <class KeyWidth>
+static void bench_key_width(const std::string &name, size_t directory_size,
+                            size_t key_count, std::uint64_t domain_mask) {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer, 3,
+                                    std::uint16_t, RegularDegree, KeyWidth>;
+
+  // multiplying by an odd constant permutes the domain, i.e., keys are
+  // distinct. Domains smaller than key_count are used up entirely instead
+  const size_t count =
+      domain_mask < key_count ? size_t(domain_mask) + 1 : key_count;
+  std::vector<std::uint64_t> keys(count);
+  for (size_t i = 0; i < keys.size(); i++)
+    keys[i] = (std::uint64_t(i) * 0x9e3779b97f4a7c15) & domain_mask;
+
+  IBF ibf(directory_size, 0);
+  const auto insert =
+      ns_per_op(keys.size(), [&] { ibf.insert(keys.data(), keys.size()); });
+  std::vector<ContainsResult> results(keys.size());
+  const auto contains = ns_per_op(keys.size(), [&] {
+    ibf.contains(keys.data(), keys.size(), results.data());
+  });
+
+  std::cout << std::setw(10) << name << std::setw(8) << IBF::bucket_bytes
+            << std::setw(12)
+            << directory_size * IBF::bucket_bytes / double(1 << 20)
+            << std::setw(12) << keys.size() << std::setw(12) << insert
+            << std::setw(12) << contains << std::endl;
+}
+
+/**
+ * Memory and batched ns per op of a multi-GB directory holding distinct 64-bit
+ * keys at full width versus bounded keys stored in fewer bits. The 24-bit
+ * domain only holds 2^24 distinct keys, i.e., an eighth of the others' load
+ */
+static void bench_key_width() {
+  constexpr size_t directory_size = size_t(1) << 27;
+  constexpr size_t key_count = directory_size / 2;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "key width, directory size " << directory_size << std::endl;
+  std::cout << std::setw(10) << "width" << std::setw(8) << "bytes"
+            << std::setw(12) << "MiB" << std::setw(12) << "keys"
+            << std::setw(12) << "insert" << std::setw(12) << "contains"
+            << std::endl;
+
+  bench_key_width<FullKeyWidth>("64 (full)", directory_size, key_count,
+                                ~std::uint64_t(0));
+  bench_key_width<PackedKeyWidth<48>>("48", directory_size, key_count,
+                                      (std::uint64_t(1) << 48) - 1);
+  bench_key_width<PackedKeyWidth<40>>("40", directory_size, key_count,
+                                      (std::uint64_t(1) << 40) - 1);
+  bench_key_width<PackedKeyWidth<32>>("32", directory_size, key_count,
+                                      (std::uint64_t(1) << 32) - 1);
+  bench_key_width<PackedKeyWidth<24>>("24", directory_size, key_count,
+                                      (std::uint64_t(1) << 24) - 1);
+  std::cout << std::endl;
+}
+
+/**
+ * ms per listAll() of filters and dictionaries at load 0.7 (K = 3), from
+ * cache resident directories up to ones far exceeding the LLC
+ */
+static void bench_decode() {
+  using IBF = InvertibleBloomFilter<std::uint64_t, Murmur3Finalizer>;
+  using IBD = InvertibleBloomDictionary<std::uint64_t, std::uint64_t,
+                                        Murmur3Finalizer>;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "decode at load 0.7, ms (ns per key)" << std::endl;
+  std::cout << std::setw(12) << "directory" << std::setw(22) << "filter"
+            << std::setw(22) << "dictionary" << std::endl;
+
+  for (const size_t directory_size :
+       {size_t(1) << 14, size_t(1) << 20, size_t(1) << 24}) {
+    const auto keys = random_keys(directory_size * 7 / 10, 0);
+
+    IBF ibf(directory_size, 0);
+    ibf.insert(keys.data(), keys.size());
+    const auto filter_ns = best_ns_per_op(
+        keys.size(), [&] { sink = ibf.listAll()->size(); });
+
+    IBD ibd(directory_size, 0);
+    ibd.insert(keys.data(), keys.data(), keys.size());
+    const auto dictionary_ns = best_ns_per_op(
+        keys.size(), [&] { sink = ibd.listAll()->size(); });
+
+    const auto ms = [&](double ns) { return ns * keys.size() / 1e6; };
+    std::cout << std::setw(12) << directory_size << std::setw(12)
+              << ms(filter_ns) << " (" << std::setw(6) << filter_ns << ")"
+              << std::setw(12) << ms(dictionary_ns) << " (" << std::setw(6)
+              << dictionary_ns << ")" << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, char **argv) {
+  // optionally only run the benchmark named by the first argument
+  const std::string only = argc > 1 ? argv[1] : "";
+
+  const std::vector<std::pair<std::string, void (*)()>> benchmarks{
+      {"probe_kernels", bench_probe_kernels},
+      {"coupled_threshold", bench_coupled_threshold},
+      {"degree_threshold", bench_degree_threshold},
+      {"hash_families", bench_hash_families},
+      {"hash_speed", bench_hash_speed},
+      {"two_tier", bench_two_tier},
+      {"flow_encoder", bench_flow_encoder},
+      {"paged_directory", bench_paged_directory},
+      {"runtime_k", bench_runtime_k},
+      {"filter_bank", bench_filter_bank},
+      {"early_abort", bench_early_abort},
+      {"gf2_solve", bench_gf2_solve},
+      {"stash", bench_stash},
+      {"freeze", bench_freeze},
+      {"key_width", bench_key_width},
+      {"decode", bench_decode},
+  };
+
+  for (const auto &[name, benchmark] : benchmarks)
+    if (only.empty() || only == name)
+      benchmark();
+
+  return 0;
+}